@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "alloc.h"
+#include "context.h"
+#include "output.h"
+#include "parser.h"
+#include "stats.h"
+#include "symtab.h"
+
+#define CHECK_DEPTH 5           // the deepest random line checked
+#define CHECK_LINE 4096         // long enough for any line that deep
+
+int alloc_tracking;
+int alloc_per_line;
+
+static alloc_stats_t counts;
+static unsigned int check_seed;
+static long check_fresh;        // the number of new names made up so far
+
+// Put in front of every block while tracking, keeping the memory after
+// it aligned for anything
+typedef union header_u {
+    size_t size;
+    long double ld;
+    long long ll;
+    void *p;
+} header_t;
+
+void start_alloc_tracking(int per_line) {
+    alloc_tracking = 1;
+    alloc_per_line = per_line;
+}
+
+/// Counts memory being allocated
+///
+/// @param size The number of bytes
+static void count_allocation(size_t size) {
+    __atomic_fetch_add(&counts.allocations, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counts.live, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counts.bytes, (long long)size, __ATOMIC_RELAXED);
+}
+
+/// Changes the live bytes, raising the peak if they pass it
+///
+/// @param change The bytes allocated, or freed if negative
+static void count_live_bytes(long long change) {
+    long long live = __atomic_add_fetch(&counts.live_bytes, change, __ATOMIC_RELAXED);
+    long long peak = __atomic_load_n(&counts.peak_bytes, __ATOMIC_RELAXED);
+
+    while (live > peak && !__atomic_compare_exchange_n(&counts.peak_bytes, &peak, live, 1,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void *tracked_malloc(size_t size) {
+    STAT_ADD(allocations, 1);
+    if (!alloc_tracking) {
+        return malloc(size);
+    }
+
+    header_t *header = (header_t *)malloc(sizeof(header_t) + size);
+    if (header == NULL) {
+        return NULL;
+    }
+    header -> size = size;
+    count_allocation(size);
+    count_live_bytes((long long)size);
+    return header + 1;
+}
+
+void *tracked_calloc(size_t count, size_t size) {
+    STAT_ADD(allocations, 1);
+    if (!alloc_tracking) {
+        return calloc(count, size);
+    }
+    if (size && count > ((size_t)-1 - sizeof(header_t)) / size) {
+        return NULL;
+    }
+
+    header_t *header = (header_t *)calloc(1, sizeof(header_t) + count * size);
+    if (header == NULL) {
+        return NULL;
+    }
+    header -> size = count * size;
+    count_allocation(count * size);
+    count_live_bytes((long long)(count * size));
+    return header + 1;
+}
+
+void *tracked_realloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return tracked_malloc(size);
+    }
+    STAT_ADD(allocations, 1);
+    if (!alloc_tracking) {
+        return realloc(ptr, size);
+    }
+
+    header_t *header = (header_t *)ptr - 1;
+    size_t old_size = header -> size;
+    header = (header_t *)realloc(header, sizeof(header_t) + size);
+    if (header == NULL) {
+        return NULL;
+    }
+    header -> size = size;
+
+    // The block is still one object, just a different size
+    __atomic_fetch_add(&counts.allocations, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&counts.bytes, (long long)size, __ATOMIC_RELAXED);
+    count_live_bytes((long long)size - (long long)old_size);
+    return header + 1;
+}
+
+void tracked_free(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    if (!alloc_tracking) {
+        free(ptr);
+        return;
+    }
+
+    header_t *header = (header_t *)ptr - 1;
+    __atomic_fetch_add(&counts.frees, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&counts.live, 1, __ATOMIC_RELAXED);
+    count_live_bytes(-(long long)header -> size);
+    free(header);
+}
+
+void get_alloc_stats(alloc_stats_t *stats) {
+    stats -> allocations = __atomic_load_n(&counts.allocations, __ATOMIC_RELAXED);
+    stats -> frees = __atomic_load_n(&counts.frees, __ATOMIC_RELAXED);
+    stats -> bytes = __atomic_load_n(&counts.bytes, __ATOMIC_RELAXED);
+    stats -> live = __atomic_load_n(&counts.live, __ATOMIC_RELAXED);
+    stats -> live_bytes = __atomic_load_n(&counts.live_bytes, __ATOMIC_RELAXED);
+    stats -> peak_bytes = __atomic_load_n(&counts.peak_bytes, __ATOMIC_RELAXED);
+}
+
+void print_alloc_stats(FILE *fp) {
+    alloc_stats_t stats;
+
+    get_alloc_stats(&stats);
+    fprintf(fp, "ALLOCATIONS:\n");
+    fprintf(fp, "\tallocations: %lld\n", stats.allocations);
+    fprintf(fp, "\tfrees: %lld\n", stats.frees);
+    fprintf(fp, "\tbytes: %lld\n", stats.bytes);
+    fprintf(fp, "\tlive objects: %lld\n", stats.live);
+    fprintf(fp, "\tlive bytes: %lld\n", stats.live_bytes);
+    fprintf(fp, "\tpeak bytes: %lld\n", stats.peak_bytes);
+}
+
+void print_alloc_change(FILE *fp, alloc_stats_t *before, alloc_stats_t *after) {
+    fprintf(fp, "Allocated %lld (%lld bytes), freed %lld, live %+lld (%+lld bytes)\n",
+            after -> allocations - before -> allocations, after -> bytes - before -> bytes,
+            after -> frees - before -> frees, after -> live - before -> live,
+            after -> live_bytes - before -> live_bytes);
+}
+
+/// Picks a random number
+///
+/// @param n The number of choices
+/// @return Returns a number from 0 to n - 1
+static int pick(int n) {
+    // xorshift, so the lines are the same on every platform
+    check_seed ^= check_seed << 13;
+    check_seed ^= check_seed >> 17;
+    check_seed ^= check_seed << 5;
+    return (int)(check_seed % n);
+}
+
+/// Writes a random postfix expression
+///
+/// @param dst Where to write it
+/// @param depth How much deeper it may nest
+/// @return Returns the end of what was written
+static char *random_expression(char *dst, int depth) {
+    static const char *leaves[] = { "a", "b", "c", "d", "u", "0", "1", "7", "100" };
+    static const char *ops[] = { "+", "-", "*", "/", "%", "?", "=" };
+
+    if (depth == 0 || pick(4) == 0) {
+        return dst + sprintf(dst, "%s ", leaves[pick(9)]);
+    }
+
+    const char *op = ops[pick(7)];
+    if (*op == '=') {
+        // Never u, it must stay undefined
+        dst += sprintf(dst, "%s ", leaves[pick(4)]);
+    }
+    else {
+        dst = random_expression(dst, depth - 1);
+    }
+    if (*op == '?') {
+        dst = random_expression(dst, depth - 1);
+    }
+    dst = random_expression(dst, depth - 1);
+    return dst + sprintf(dst, "%s ", op);
+}
+
+/// Writes a random line, broken in one of the ways make_parse_tree
+/// reports about half of the time.  About one line in five names a
+/// symbol that no line has named before, in the same number of
+/// characters each time, and that never gets defined.
+///
+/// @param dst Where to write it
+static void random_line(char *dst) {
+    int broken = pick(10);
+    char *end = dst;
+
+    // An extra operand in front is too many tokens, and a number is
+    // an invalid assignment to the left of an = at the end
+    if (broken == 0 || broken == 1) {
+        end += sprintf(end, "1 ");
+    }
+    else if (broken == 5) {
+        end += sprintf(end, "new%09ld ", check_fresh++);
+    }
+    end = random_expression(end, CHECK_DEPTH);
+    switch (broken) {
+        case 1:
+            end += sprintf(end, "= ");
+            break;
+        case 2:
+            end += sprintf(end, "+ ");
+            break;
+        case 3:
+            end += sprintf(end, "@ 1 + ");
+            break;
+        case 4:
+            end += sprintf(end, "# a comment ");
+            break;
+        case 6:
+            end += sprintf(end, "new%09ld + ", check_fresh++);
+            break;
+    }
+    end[-1] = '\0';
+}
+
+long long check_allocations(long count, alloc_stats_t *warm, alloc_stats_t *after) {
+    static char *names[] = { "a", "b", "c", "d" };
+    char line[CHECK_LINE];
+    output_t sink;
+
+    for (int i = 0; i < 4; i++) {
+        if (lookup_table(names[i]) == NULL) {
+            create_symbol(names[i], 0);
+        }
+    }
+
+    // What the lines print is kept in memory and dropped after each
+    FILE *errors = fopen("/dev/null", "w");
+    if (errors == NULL) {
+        perror("/dev/null");
+        exit(EXIT_FAILURE);
+    }
+    init_output(&sink, -1, 0);
+    default_context.out = &sink;
+    default_context.err = errors;
+
+    for (int pass = 0; pass < 2; pass++) {
+        check_seed = 1;
+        for (long n = 0; n < count; n++) {
+            random_line(line);
+            rep(line);
+            sink.len = 0;
+        }
+        get_alloc_stats(pass == 0 ? warm : after);
+    }
+
+    default_context.out = NULL;
+    default_context.err = NULL;
+    free_output(&sink);
+    fclose(errors);
+    return after -> live_bytes - warm -> live_bytes;
+}
@@ -0,0 +1,90 @@
+// Counted allocation for everything the interpreter keeps on the heap
+
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/// What the tracked allocations have cost so far
+typedef struct alloc_stats_s {
+    long long allocations;      ///< calls to tracked_malloc, tracked_calloc and tracked_realloc
+    long long frees;            ///< calls to tracked_free that freed something
+    long long bytes;            ///< bytes asked for in all
+    long long live;             ///< objects not yet freed
+    long long live_bytes;       ///< bytes not yet freed
+    long long peak_bytes;       ///< the most live_bytes has been
+} alloc_stats_t;
+
+/// Whether allocations are counted, and whether rep displays what
+/// each line cost.  Nothing is counted or stored with the memory
+/// when they are off.
+extern int alloc_tracking;
+extern int alloc_per_line;
+
+/// Starts counting allocations.  While counting, every block carries
+/// its size so tracked_free can tell how many bytes it gives back,
+/// which means this has to be called before anything is allocated
+/// with the functions below.  The counters are atomic, so the batch
+/// worker threads may allocate too, but then what one line cost is
+/// mixed with what the others cost at the same time.
+/// @param per_line Whether rep displays what each line allocated,
+///     freed and left live to standard error
+void start_alloc_tracking(int per_line);
+
+/// malloc, counted when tracking is on
+/// @param size The number of bytes
+/// @return the memory, or NULL if it couldn't be allocated
+void *tracked_malloc(size_t size);
+
+/// calloc, counted when tracking is on
+/// @param count The number of elements
+/// @param size The size of each element
+/// @return the zeroed memory, or NULL if it couldn't be allocated
+void *tracked_calloc(size_t count, size_t size);
+
+/// realloc, counted when tracking is on.  Moving a block counts as
+/// one allocation and changes the live bytes by the difference.
+/// @param ptr Memory from these functions, or NULL
+/// @param size The new number of bytes
+/// @return the memory, or NULL if it couldn't be allocated, in which
+///     case ptr is untouched
+void *tracked_realloc(void *ptr, size_t size);
+
+/// free, for memory from the functions above
+/// @param ptr The memory (may be NULL)
+void tracked_free(void *ptr);
+
+/// Copies the counters
+/// @param stats Where to copy them
+void get_alloc_stats(alloc_stats_t *stats);
+
+/// Prints all of the counters
+/// @param fp Where to print them
+void print_alloc_stats(FILE *fp);
+
+/// Prints what was allocated and freed between two copies of the
+/// counters, as one line
+/// @param fp Where to print it
+/// @param before The counters before
+/// @param after The counters after
+void print_alloc_change(FILE *fp, alloc_stats_t *before, alloc_stats_t *after);
+
+/// Evaluates random lines, many of them with parse or evaluation
+/// errors, over the symbols a, b, c and d and the undefined symbol u,
+/// then evaluates the same lines again.  Some lines also name a symbol
+/// never named before, which is new in the second pass too, so memory
+/// kept for every name a line mentions shows up as growth.  The first
+/// pass is the warm-up that grows the tables, stacks and arenas as far
+/// as the lines need, so nothing should be live after the second that
+/// wasn't after the first.  The cache keeps each new line until it is
+/// full, so it should hold fewer lines than count.  The output of the
+/// lines is thrown away.  Tracking has to be on.
+/// @param count The number of lines in each pass
+/// @param warm The counters after the warm-up
+/// @param after The counters after the second pass
+/// @return the number of bytes left live by the second pass, 0 if
+///     nothing leaked
+long long check_allocations(long count, alloc_stats_t *warm, alloc_stats_t *after);
+
+#endif
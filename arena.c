@@ -0,0 +1,104 @@
+#include "arena.h"
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Everything handed out is aligned to the strictest of these
+typedef union align_u {
+    long l;
+    double d;
+    void *p;
+} align_t;
+
+#define ALIGN(n) (((n) + sizeof(align_t) - 1) & ~(sizeof(align_t) - 1))
+
+void arena_init(arena_t *arena) {
+    arena -> head = NULL;
+}
+
+/// Puts a new chunk of at least size bytes at the head of the arena
+///
+/// @param arena The arena to add the chunk to
+/// @param size The minimum number of usable bytes
+/// @return Returns the new chunk, or NULL if it could not be allocated
+static arena_chunk_t *add_chunk(arena_t *arena, size_t size) {
+    size_t chunk_size = ARENA_CHUNK;
+
+    // Each chunk is at least double the last so growth stays logarithmic
+    if (arena -> head && arena -> head -> size * 2 > chunk_size) {
+        chunk_size = arena -> head -> size * 2;
+    }
+    while (chunk_size < size) {
+        chunk_size *= 2;
+    }
+
+    arena_chunk_t *chunk = (arena_chunk_t *)tracked_malloc(sizeof(arena_chunk_t) + chunk_size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk -> next = arena -> head;
+    chunk -> size = chunk_size;
+    chunk -> used = 0;
+    arena -> head = chunk;
+    return chunk;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    arena_chunk_t *chunk = arena -> head;
+    size = ALIGN(size);
+
+    if (chunk == NULL || chunk -> size - chunk -> used < size) {
+        chunk = add_chunk(arena, size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+    }
+
+    void *mem = chunk -> data + chunk -> used;
+    chunk -> used += size;
+    return mem;
+}
+
+char *arena_strndup(arena_t *arena, const char *str, size_t len) {
+    char *copy = (char *)arena_alloc(arena, len + 1);
+
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void arena_reset(arena_t *arena) {
+    arena_chunk_t *chunk = arena -> head;
+
+    if (chunk == NULL) {
+        return;
+    }
+
+    // A single chunk is the steady state, just rewind it
+    if (chunk -> next == NULL) {
+        chunk -> used = 0;
+        return;
+    }
+
+    // Otherwise replace them all with one chunk big enough for everything
+    size_t total = 0;
+    for (arena_chunk_t *cur = chunk; cur; cur = cur -> next) {
+        total += cur -> size;
+    }
+    arena_free(arena);
+    add_chunk(arena, total);
+}
+
+void arena_free(arena_t *arena) {
+    arena_chunk_t *chunk = arena -> head;
+
+    while (chunk) {
+        arena_chunk_t *to_remove = chunk;
+        chunk = chunk -> next;
+        tracked_free(to_remove);
+    }
+    arena -> head = NULL;
+}
@@ -0,0 +1,51 @@
+// Bump allocator for the per-expression parse trees and tokens
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK 4096        // size of the first chunk of an arena
+
+/// A single block of memory that allocations are carved from
+typedef struct arena_chunk_s {
+    struct arena_chunk_s *next; ///< the previously filled chunk (NULL if none)
+    size_t size;                ///< usable bytes in this chunk
+    size_t used;                ///< bytes handed out so far
+    char data[];                ///< the memory itself
+} arena_chunk_t;
+
+typedef struct arena_s {
+    arena_chunk_t *head;        ///< the chunk currently being filled
+} arena_t;
+
+/// Initializes an empty arena.  No memory is allocated until
+/// the first call to arena_alloc.
+/// @param arena The arena to initialize
+void arena_init(arena_t *arena);
+
+/// Allocates size bytes from the arena, suitably aligned for any
+/// of the tree structures.  The memory is not zeroed.
+/// @param arena The arena to allocate from
+/// @param size The number of bytes needed
+/// @return the memory, or NULL if a new chunk could not be allocated
+void *arena_alloc(arena_t *arena, size_t size);
+
+/// Copies len characters of str into the arena as a C string
+/// @param arena The arena to allocate from
+/// @param str The characters to copy (need not be null terminated)
+/// @param len The number of characters to copy
+/// @return the new string, or NULL if it could not be allocated
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+
+/// Releases everything allocated from the arena in O(1).  The memory
+/// is kept for reuse; if the arena had to grow past one chunk, the
+/// chunks are merged so the next round fits without allocating.
+/// @param arena The arena to reset
+void arena_reset(arena_t *arena);
+
+/// Gives all of the arena's memory back to the system
+/// @param arena The arena to free
+void arena_free(arena_t *arena);
+
+#endif
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "alloc.h"
+#include "parser.h"
+#include "output.h"
+#include "parallel.h"
+#include "stats.h"
+
+void buffer_output(void) {
+    standard_output() -> interactive = 0;
+}
+
+/// Evaluates the complete lines of a block, either one at a time or
+/// all together on the thread pool
+///
+/// @param lines The lines to evaluate
+/// @param count The number of lines
+/// @param threads The number of threads to evaluate with
+static void rep_lines(char **lines, int count, int threads) {
+    if (threads > 1) {
+        rep_parallel(lines, count);
+        poll_stats(stderr);
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        rep(lines[i]);
+        poll_stats(stderr);
+    }
+}
+
+void run_batch(FILE *fp, int threads) {
+    size_t size = BATCH_BLOCK, used = 0;
+    char *block = (char *)tracked_malloc(size + 1);
+    int max_lines = 1024, count;
+    char **lines = (char **)tracked_malloc(sizeof(char *) * max_lines);
+
+    if (block == NULL || lines == NULL) {
+        fprintf(stderr, "Could not allocate the input buffer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Our own block is the buffer, so stdio doesn't need another
+    setvbuf(fp, NULL, _IONBF, 0);
+
+    for (;;) {
+        size_t got = fread(block + used, 1, size - used, fp);
+        if (got == 0) {
+            break;
+        }
+        used += got;
+
+        // Evaluate every complete line straight out of the block
+        char *line = block, *end = block + used, *newline;
+        count = 0;
+        while ((newline = memchr(line, '\n', end - line)) != NULL) {
+            if (count == max_lines) {
+                max_lines *= 2;
+                char **more = (char **)tracked_realloc(lines, sizeof(char *) * max_lines);
+                if (more == NULL) {
+                    fprintf(stderr, "Could not allocate the line index\n");
+                    exit(EXIT_FAILURE);
+                }
+                lines = more;
+            }
+            *newline = '\0';
+            lines[count++] = line;
+            line = newline + 1;
+        }
+        rep_lines(lines, count, threads);
+
+        // Move the partial last line to the front for the next read,
+        // growing the block if a single line has filled it
+        used = end - line;
+        memmove(block, line, used);
+        if (used == size) {
+            size *= 2;
+            char *bigger = (char *)tracked_realloc(block, size + 1);
+            if (bigger == NULL) {
+                fprintf(stderr, "Line too long to evaluate\n");
+                exit(EXIT_FAILURE);
+            }
+            block = bigger;
+        }
+    }
+
+    if (ferror(fp)) {
+        fprintf(stderr, "Error reading the expressions\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The last line may not end with a newline
+    if (used) {
+        block[used] = '\0';
+        lines[0] = block;
+        rep_lines(lines, 1, threads);
+    }
+    tracked_free(lines);
+    tracked_free(block);
+}
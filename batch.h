@@ -0,0 +1,26 @@
+// Non-interactive evaluation of whole files of expressions
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h>
+
+#define BATCH_BLOCK (1 << 20)   // bytes read from the input at a time
+
+/// Runs rep on every line of a file, with no prompts.  The file is
+/// read in large blocks and each line is evaluated in place in the
+/// block, so lines may be any length.  Standard output should already
+/// be fully buffered (see buffer_output).
+/// @param fp The file to read the expressions from
+/// @param threads The number of threads to evaluate with, the pool
+///     must have been started with start_workers if this is over 1
+/// @exception If the file can't be read or a line doesn't fit in
+///     memory, an error message is displayed to standard error and
+///     the program exits with EXIT_FAILURE
+void run_batch(FILE *fp, int threads);
+
+/// Switches standard output to writing its buffer out only when it is
+/// full, even on a terminal (see output.h).
+void buffer_output(void);
+
+#endif
@@ -0,0 +1,693 @@
+/// Benchmarks for the tokenizer, parser, evaluator and symbol table.
+/// Each measurement is printed as one JSON object per line on
+/// standard output.
+///
+/// Usage: bench [scale]
+///
+/// where scale multiplies the number of repetitions (default 1).
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "parser.h"
+#include "context.h"
+#include "bytecode.h"
+#include "intern.h"
+#include "lexer.h"
+#include "optimize.h"
+#include "output.h"
+#include "script.h"
+#include "symtab.h"
+
+#define NUM_LOOKUPS 1000000     // lookups timed for each table size
+#define DEEP_OPS 1000000        // operators in the deepest lines
+#define SHALLOW_OPS 10000       // operators in the lines they are compared to
+#define MAX_SLOWDOWN 4          // how much longer a deep line may take per operator
+#define MAX_OP_BYTES 1024       // how much memory a deep line may take per operator
+
+// Where the results go, standard output itself is sent to /dev/null
+// so print_infix and rep can be timed without flooding the report.
+// The interpreter writes to the descriptor rather than stdout.
+static FILE *report_fp;
+static double scale = 1.0;
+
+/// Reads the monotonic clock
+///
+/// @return Returns the time in seconds
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// Finds the most memory the process has used so far
+///
+/// @return Returns the peak resident set size in kilobytes
+static long peak_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/// Scales a repetition count, never going below one
+///
+/// @param count The count at scale 1
+/// @return Returns the scaled count
+static long scaled(long count) {
+    long n = (long)(count * scale);
+    return n > 0 ? n : 1;
+}
+
+/// Prints one measurement
+///
+/// @param phase What was timed
+/// @param workload What it was timed on
+/// @param unit What an item is (tokens, parses, evals, ...)
+/// @param items How many items were processed
+/// @param seconds How long it took
+static void report(const char *phase, const char *workload, const char *unit,
+                   long items, double seconds) {
+    fprintf(report_fp, "{\"phase\": \"%s\", \"workload\": \"%s\", \"items\": %ld, "
+            "\"seconds\": %.6f, \"%s_per_sec\": %.1f, \"ns_per_item\": %.2f, "
+            "\"peak_rss_kb\": %ld}\n", phase, workload, items, seconds, unit,
+            seconds > 0 ? items / seconds : 0.0, items ? seconds * 1e9 / items : 0.0,
+            peak_rss_kb());
+    fflush(report_fp);
+}
+
+/// Makes a long left-deep line: x 1 + 2 + 3 + ...
+///
+/// @param ops The number of operators
+/// @return Returns the line (heap allocated)
+static char *flat_expression(int ops) {
+    char *line = (char *)malloc(16 * (size_t)ops + 8), *end = line;
+
+    end += sprintf(end, "x");
+    for (int i = 1; i <= ops; i++) {
+        end += sprintf(end, " %d %c", i, "+-*+"[i % 4]);
+    }
+    return line;
+}
+
+/// Makes a chain of ? nested in the else branches, with conditions
+/// that are all false so evaluation runs to the bottom:
+/// zero 1 zero 2 ... zero n x ? ? ... ?
+///
+/// @param depth The number of ? operators
+/// @return Returns the line (heap allocated)
+static char *nested_conditions(int depth) {
+    char *line = (char *)malloc(20 * (size_t)depth + 8), *end = line;
+
+    for (int i = 1; i <= depth; i++) {
+        end += sprintf(end, "zero %d ", i);
+    }
+    end += sprintf(end, "x");
+    for (int i = 0; i < depth; i++) {
+        end += sprintf(end, " ?");
+    }
+    return line;
+}
+
+/// Times every phase of evaluating one line
+///
+/// @param workload The name of the line
+/// @param line The line
+/// @param reps How many times to repeat each phase
+static void bench_expression(const char *workload, char *line, long reps) {
+    lexer_t lexer;
+    token_t token;
+    long tokens = 0;
+    double start = now();
+
+    for (long r = 0; r < reps; r++) {
+        init_lexer(&lexer, line);
+        while (next_token(&lexer, &token) != TOKEN_END) {
+            tokens++;
+        }
+    }
+    report("tokenize", workload, "tokens", tokens, now() - start);
+
+    start = now();
+    for (long r = 0; r < reps; r++) {
+        cleanup_tree(make_parse_tree(line));
+    }
+    report("parse", workload, "parses", reps, now() - start);
+
+    tree_node_t *tree = make_parse_tree(line);
+    if (default_context.parse_error != PARSE_NONE) {
+        fprintf(stderr, "bench: %s does not parse\n", workload);
+        exit(EXIT_FAILURE);
+    }
+
+    start = now();
+    for (long r = 0; r < reps; r++) {
+        eval_tree(tree);
+    }
+    report("eval_tree", workload, "evals", reps, now() - start);
+
+    program_t prog;
+    vm_t vm;
+    eval_error_t error;
+    init_program(&prog);
+    init_vm(&vm);
+    compile_tree(&prog, tree);
+    start = now();
+    for (long r = 0; r < reps; r++) {
+        run_program(&vm, &prog, &error);
+    }
+    report("run_program", workload, "evals", reps, now() - start);
+    free_program(&prog);
+    free_vm(&vm);
+
+    start = now();
+    for (long r = 0; r < reps; r++) {
+        print_infix(tree);
+    }
+    flush_output(standard_output());
+    report("print_infix", workload, "prints", reps, now() - start);
+
+    cleanup_tree(tree);
+    default_context.eval_error = EVAL_NONE;
+}
+
+/// Takes a line through every stage: parsing, simplifying, compiling,
+/// running, walking the tree and printing
+///
+/// @param line The line
+static void run_stages(char *line) {
+    program_t prog;
+    vm_t vm;
+    eval_error_t error;
+
+    init_program(&prog);
+    init_vm(&vm);
+    tree_node_t *tree = make_parse_tree(line);
+    compile_tree(&prog, optimize_tree(&default_context.arena, tree));
+    run_program(&vm, &prog, &error);
+    eval_tree(tree);
+    print_infix(tree);
+    cleanup_tree(tree);
+    free_program(&prog);
+    free_vm(&vm);
+    default_context.eval_error = EVAL_NONE;
+}
+
+/// Times lines of a million operators through every stage, and checks
+/// that they take time and memory in proportion to their length.  The
+/// tree walks keep their place on explicit stacks, so lines this deep
+/// must not run out of native stack either.
+///
+/// @param workload The name of the kind of line
+/// @param make Makes a line with the given number of operators
+static void bench_deep(const char *workload, char *(*make)(int)) {
+    char name[64];
+    long reps = DEEP_OPS / SHALLOW_OPS;
+    char *line = make(SHALLOW_OPS);
+
+    // The same number of operators, in short lines
+    double start = now();
+    for (long r = 0; r < reps; r++) {
+        run_stages(line);
+    }
+    double shallow = now() - start;
+    free(line);
+    snprintf(name, sizeof(name), "%s_%d", workload, SHALLOW_OPS);
+    report("deep", name, "ops", reps * SHALLOW_OPS, shallow);
+
+    line = make(DEEP_OPS);
+    long rss = peak_rss_kb();
+    start = now();
+    run_stages(line);
+    double deep = now() - start;
+    long grew_kb = peak_rss_kb() - rss;
+    free(line);
+    snprintf(name, sizeof(name), "%s_%d", workload, DEEP_OPS);
+    report("deep", name, "ops", DEEP_OPS, deep);
+
+    if (deep > shallow * MAX_SLOWDOWN) {
+        fprintf(stderr, "bench: %s took %.1f times as long per operator as %s_%d\n",
+                name, deep / shallow, workload, SHALLOW_OPS);
+        exit(EXIT_FAILURE);
+    }
+    if (grew_kb * 1024 > (long)MAX_OP_BYTES * DEEP_OPS) {
+        fprintf(stderr, "bench: %s took %ld bytes per operator\n",
+                name, grew_kb * 1024 / DEEP_OPS);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/// Times loading a table of the given size, then looking symbols up in it
+///
+/// @param size The number of symbols
+static void bench_table(int size) {
+    char workload[32], path[] = "/tmp/benchXXXXXX";
+    int fd = mkstemp(path);
+    FILE *fp = fd < 0 ? NULL : fdopen(fd, "w");
+
+    if (fp == NULL) {
+        perror("bench: temporary table");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < size; i++) {
+        fprintf(fp, "sym%d %d\n", i, i);
+    }
+    fclose(fp);
+    sprintf(workload, "table_%d", size);
+
+    double start = now();
+    build_table(path);
+    report("build_table", workload, "symbols", size, now() - start);
+
+    // The lookups below run on the table as loaded from its snapshot
+    save_table(path);
+    free_table();
+    start = now();
+    load_table(path);
+    report("load_table", workload, "symbols", size, now() - start);
+    remove(path);
+
+    // Names are made up front so only the lookups are timed, half
+    // of them are for symbols that aren't in the table
+    long lookups = scaled(NUM_LOOKUPS);
+    char (*names)[16] = malloc(sizeof(*names) * 1024);
+    srand(size);
+    for (int i = 0; i < 1024; i++) {
+        sprintf(names[i], i % 2 ? "sym%d" : "missing%d", rand() % size);
+    }
+
+    long found = 0;
+    start = now();
+    for (long i = 0; i < lookups; i++) {
+        found += lookup_table(names[i & 1023]) != NULL;
+    }
+    report("lookup_table", workload, "lookups", lookups, now() - start);
+    if (found == 0) {
+        fprintf(stderr, "bench: no symbols found in %s\n", workload);
+    }
+    free(names);
+    free_table();
+}
+
+/// Makes a line of the script bench_assignments runs
+///
+/// @param line Where to write it, at least 64 characters
+/// @param i The number of the line
+static void assignment_line(char *line, long i) {
+    int a = i % 101, b = (i * 7) % 101;
+
+    if (i % 3 == 0) {
+        sprintf(line, "a%d %ld =", a, i);
+    }
+    else if (i % 3 == 1) {
+        sprintf(line, "a%d a%d a%d 1 + * =", a, a, b);
+    }
+    else {
+        sprintf(line, "t a%d a%d zero ? =", a, b);
+    }
+}
+
+/// Defines every symbol the assignment script reads, so none of its
+/// lines stops at an undefined one
+static void define_script_symbols(void) {
+    char line[64];
+
+    rep("zero 0 =");
+    for (int i = 0; i < 101; i++) {
+        sprintf(line, "a%d 0 =", i);
+        rep(line);
+    }
+}
+
+/// Times rep on a script where every line assigns
+///
+/// @param lines The number of lines to run
+static void bench_assignments(long lines) {
+    char line[64];
+
+    // Every symbol the script reads is defined before the timing starts
+    define_script_symbols();
+    double start = now();
+
+    for (long i = 0; i < lines; i++) {
+        assignment_line(line, i);
+        rep(line);
+    }
+    flush_output(standard_output());
+    report("rep", "assignments", "lines", lines, now() - start);
+    free_table();
+}
+
+/// Times compiling the assignment script ahead of time, then running
+/// it from the compiled file with no parsing
+///
+/// @param lines The number of lines in the script
+static void bench_script(long lines) {
+    char script[] = "/tmp/benchXXXXXX", compiled[] = "/tmp/benchXXXXXX", line[64];
+    int fd = mkstemp(script), compiled_fd = mkstemp(compiled);
+    FILE *fp = fd < 0 ? NULL : fdopen(fd, "w");
+
+    if (fp == NULL || compiled_fd < 0) {
+        perror("bench: temporary script");
+        exit(EXIT_FAILURE);
+    }
+    close(compiled_fd);
+    for (long i = 0; i < lines; i++) {
+        assignment_line(line, i);
+        fprintf(fp, "%s\n", line);
+    }
+    fclose(fp);
+
+    double start = now();
+    compile_script(script, compiled);
+    report("compile_script", "assignments", "lines", lines, now() - start);
+
+    // Run against the same symbols bench_assignments starts with
+    define_script_symbols();
+    start = now();
+    run_script(compiled);
+    flush_output(standard_output());
+    report("run_script", "assignments", "lines", lines, now() - start);
+    free_table();
+    remove(compiled);
+    remove(script);
+}
+
+/// One thread of bench_contexts, with an interpreter of its own
+typedef struct context_job_s {
+    context_t ctx;              ///< the interpreter
+    output_t out;               ///< its results, on /dev/null
+    long lines;                 ///< how many lines of the script to run
+    int result;                 ///< the value of a0 at the end
+} context_job_t;
+
+/// Runs the assignment script in a thread's own context
+///
+/// @param arg The context_job_t
+/// @return Returns NULL
+static void *run_context(void *arg) {
+    context_job_t *job = (context_job_t *)arg;
+    char line[64];
+
+    ctx_rep(&job -> ctx, "zero 0 =");
+    for (int i = 0; i < 101; i++) {
+        sprintf(line, "a%d 0 =", i);
+        ctx_rep(&job -> ctx, line);
+    }
+    for (long i = 0; i < job -> lines; i++) {
+        assignment_line(line, i);
+        ctx_rep(&job -> ctx, line);
+    }
+    job -> result = ctx_lookup_table(&job -> ctx, "a0") -> val;
+    return NULL;
+}
+
+/// Times the assignment script run in several contexts at once, one
+/// thread each, and checks they all end up with the same symbols
+///
+/// @param threads The number of contexts
+/// @param lines The number of lines each one runs
+static void bench_contexts(int threads, long lines) {
+    context_job_t *jobs = (context_job_t *)malloc(sizeof(context_job_t) * threads);
+    pthread_t *ids = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+    char workload[32];
+
+    if (jobs == NULL || ids == NULL) {
+        perror("bench: contexts");
+        exit(EXIT_FAILURE);
+    }
+
+    // Each context has its own output buffer and descriptor too
+    for (int i = 0; i < threads; i++) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd < 0) {
+            perror("bench: /dev/null");
+            exit(EXIT_FAILURE);
+        }
+        init_output(&jobs[i].out, fd, 0);
+        init_context(&jobs[i].ctx, &jobs[i].out, NULL);
+    }
+
+    double start = now();
+    for (int i = 0; i < threads; i++) {
+        jobs[i].lines = lines;
+        pthread_create(&ids[i], NULL, run_context, &jobs[i]);
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    sprintf(workload, "contexts_%d", threads);
+    report("ctx_rep", workload, "lines", lines * threads, now() - start);
+
+    for (int i = 0; i < threads; i++) {
+        if (jobs[i].result != jobs[0].result) {
+            fprintf(stderr, "bench: context %d ended with a0 = %d, not %d\n",
+                    i, jobs[i].result, jobs[0].result);
+            exit(EXIT_FAILURE);
+        }
+        free_output(&jobs[i].out);
+        close(jobs[i].out.fd);
+        free_context(&jobs[i].ctx);
+    }
+    free(ids);
+    free(jobs);
+}
+
+/// One thread of bench_shared, with a context using the shared table
+typedef struct shared_job_s {
+    context_t ctx;              ///< the interpreter
+    output_t out;               ///< its results, on /dev/null
+    int writer;                 ///< the writer it is, or -1 for a reader
+    long lines;                 ///< how many lines it evaluated
+} shared_job_t;
+
+static int shared_writers;      // the writers bench_shared starts
+static long shared_writes;      // the values each of them writes
+static int writers_done;        // how many have finished
+
+/// Evaluates a line in a reader's context, and fails the benchmark if
+/// it had an error
+///
+/// @param job The reader
+/// @param line The line
+/// @return Returns the value of the line
+static int read_shared(shared_job_t *job, char *line) {
+    tree_node_t *tree = ctx_make_parse_tree(&job -> ctx, line);
+    int value = ctx_eval_tree(&job -> ctx, tree);
+
+    if (job -> ctx.eval_error != EVAL_NONE) {
+        fprintf(stderr, "bench: a reader got error %d from %s\n", job -> ctx.eval_error, line);
+        exit(EXIT_FAILURE);
+    }
+    ctx_cleanup_tree(&job -> ctx, tree);
+    job -> lines++;
+    return value;
+}
+
+/// Writes to the shared table, or reads it until every writer is done.
+/// Writer w adds n<w>k<k> = k, then sets q<w> and p<w> to k, in that
+/// order, for each k.  Readers check that pinned batches see q<w> - p<w>
+/// as 0 or 1, and that p<w> never goes back and n<w>k<p> is always there.
+///
+/// @param arg The shared_job_t
+/// @return Returns NULL
+static void *run_shared(void *arg) {
+    shared_job_t *job = (shared_job_t *)arg;
+    long *seen = (long *)calloc(shared_writers, sizeof(long));
+    char line[64];
+
+    if (seen == NULL) {
+        perror("bench: shared");
+        exit(EXIT_FAILURE);
+    }
+    if (job -> writer >= 0) {
+        for (long k = 1; k <= shared_writes; k++) {
+            sprintf(line, "n%dk%ld %ld =", job -> writer, k, k);
+            ctx_rep(&job -> ctx, line);
+            sprintf(line, "p%d q%d %ld = =", job -> writer, job -> writer, k);
+            ctx_rep(&job -> ctx, line);
+            job -> lines += 2;
+        }
+        __atomic_fetch_add(&writers_done, 1, __ATOMIC_SEQ_CST);
+        free(seen);
+        return NULL;
+    }
+
+    // Every other batch is pinned
+    for (long batch = 0; __atomic_load_n(&writers_done, __ATOMIC_SEQ_CST) < shared_writers; batch++) {
+        if (batch % 2) {
+            ctx_pin_table(&job -> ctx);
+        }
+        for (int w = 0; w < shared_writers; w++) {
+            if (batch % 2) {
+                sprintf(line, "q%d p%d -", w, w);
+                int gap = read_shared(job, line);
+                if (gap != 0 && gap != 1) {
+                    fprintf(stderr, "bench: a pinned reader saw q%d - p%d = %d\n", w, w, gap);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            sprintf(line, "p%d", w);
+            long p = read_shared(job, line);
+            if (p < seen[w]) {
+                fprintf(stderr, "bench: p%d went back from %ld to %ld\n", w, seen[w], p);
+                exit(EXIT_FAILURE);
+            }
+            seen[w] = p;
+            if (p > 0) {
+                sprintf(line, "n%dk%ld", w, p);
+                if (read_shared(job, line) != p) {
+                    fprintf(stderr, "bench: a reader saw the wrong value for %s\n", line);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        ctx_unpin_table(&job -> ctx);
+    }
+    free(seen);
+    return NULL;
+}
+
+/// Times readers and writers using one shared table at once, one thread
+/// each, and checks no write was lost.  Build with -fsanitize=address
+/// to check no reader touches memory after it is freed.
+///
+/// @param readers The number of reader threads
+/// @param writers The number of writer threads
+/// @param writes The values each writer writes
+static void bench_shared(int readers, int writers, long writes) {
+    int threads = readers + writers;
+    shared_job_t *jobs = (shared_job_t *)malloc(sizeof(shared_job_t) * (threads + 1));
+    pthread_t *ids = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+    char workload[48], line[64];
+
+    if (jobs == NULL || ids == NULL) {
+        perror("bench: shared");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i <= threads; i++) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd < 0) {
+            perror("bench: /dev/null");
+            exit(EXIT_FAILURE);
+        }
+        init_output(&jobs[i].out, fd, 0);
+        init_context(&jobs[i].ctx, &jobs[i].out, NULL);
+        jobs[i].writer = i < writers ? i : -1;
+        jobs[i].lines = 0;
+    }
+
+    // The last context owns the table
+    context_t *owner = &jobs[threads].ctx;
+    for (int w = 0; w < writers; w++) {
+        sprintf(line, "p%d q%d 0 = =", w, w);
+        ctx_rep(owner, line);
+    }
+    ctx_share_table(owner);
+    for (int i = 0; i < threads; i++) {
+        ctx_join_table(&jobs[i].ctx, owner);
+    }
+    shared_writers = writers;
+    shared_writes = writes;
+    writers_done = 0;
+
+    double start = now();
+    for (int i = 0; i < threads; i++) {
+        pthread_create(&ids[i], NULL, run_shared, &jobs[i]);
+    }
+    long lines = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+        lines += jobs[i].lines;
+    }
+    sprintf(workload, "readers_%d_writers_%d", readers, writers);
+    report("shared", workload, "lines", lines, now() - start);
+
+    // Every write is there
+    for (int w = 0; w < writers; w++) {
+        for (long k = 0; k <= writes; k++) {
+            if (k) {
+                sprintf(line, "n%dk%ld", w, k);
+            }
+            else {
+                sprintf(line, "p%d", w);
+            }
+            symbol_t *symbol = ctx_lookup_table(owner, line);
+            int expected = k ? k : writes;
+            if (symbol == NULL || ctx_shared_value(owner, symbol) != expected) {
+                fprintf(stderr, "bench: %s lost its value\n", line);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    for (int i = 0; i <= threads; i++) {
+        free_context(&jobs[i].ctx);
+        free_output(&jobs[i].out);
+        close(jobs[i].out.fd);
+    }
+    free(ids);
+    free(jobs);
+}
+
+/// Defines the symbols the expression workloads use
+static void define_symbols(void) {
+    create_symbol("x", 3);
+    create_symbol("zero", 0);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 2 || (argc == 2 && (scale = atof(argv[1])) <= 0)) {
+        fprintf(stderr, "Usage: bench [scale]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    report_fp = fdopen(dup(STDOUT_FILENO), "w");
+    if (report_fp == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        perror("bench");
+        exit(EXIT_FAILURE);
+    }
+
+    define_symbols();
+
+    char *line = flat_expression(10);
+    bench_expression("flat_10", line, scaled(200000));
+    free(line);
+
+    line = flat_expression(10000);
+    bench_expression("flat_10000", line, scaled(200));
+    free(line);
+
+    line = nested_conditions(10);
+    bench_expression("nested_q_10", line, scaled(200000));
+    free(line);
+
+    line = nested_conditions(5000);
+    bench_expression("nested_q_5000", line, scaled(200));
+    free(line);
+
+    bench_deep("flat", flat_expression);
+    bench_deep("nested_q", nested_conditions);
+
+    free_table();
+    bench_table(10);
+    bench_table(10000);
+    bench_table(1000000);
+
+    define_symbols();
+    bench_assignments(scaled(300000));
+    bench_script(scaled(300000));
+    bench_contexts(1, scaled(300000));
+    bench_contexts(4, scaled(300000));
+    bench_shared(4, 2, scaled(20000));
+
+    free_table();
+    free_interned();
+    fclose(report_fp);
+    return 0;
+}
@@ -0,0 +1,428 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bytecode.h"
+#include "alloc.h"
+#include "context.h"
+#include "stack.h"
+#include "symtab.h"
+
+void init_program(program_t *prog) {
+    prog -> code = NULL;
+    prog -> length = 0;
+    prog -> capacity = 0;
+    prog -> max_depth = 0;
+    prog -> version = 0;
+}
+
+/// Appends an instruction to the program
+///
+/// @param prog The program to add to
+/// @param op The opcode
+/// @param arg The immediate, jump target or error code
+/// @param name The symbol name (NULL if none)
+/// @return Returns the index of the instruction, or -1 if out of memory
+static int emit(program_t *prog, opcode_t op, int arg, char *name) {
+    if (prog -> length == prog -> capacity) {
+        int capacity = prog -> capacity ? prog -> capacity * 2 : 32;
+        instr_t *code = (instr_t *)tracked_realloc(prog -> code, capacity * sizeof(instr_t));
+        if (code == NULL) {
+            return -1;
+        }
+        prog -> code = code;
+        prog -> capacity = capacity;
+    }
+    instr_t *instr = &prog -> code[prog -> length];
+    instr -> op = op;
+    instr -> arg = arg;
+    instr -> name = name;
+    instr -> symbol = NULL;
+    return prog -> length++;
+}
+
+/// Keeps track of how deep the value stack gets
+///
+/// @param prog The program being compiled
+/// @param depth The current depth
+/// @param change How much the last instruction changed it by
+static void adjust_depth(program_t *prog, int *depth, int change) {
+    *depth += change;
+    if (*depth > prog -> max_depth) {
+        prog -> max_depth = *depth;
+    }
+}
+
+/// Emits the code for a leaf, or a node that is neither a leaf nor
+/// interior, mirroring what eval_tree does for it
+///
+/// @param prog The program to add to
+/// @param node The node to compile
+/// @param depth The depth of the value stack before the node runs
+/// @return Returns 0 on success, -1 if out of memory
+static int compile_leaf(program_t *prog, tree_node_t *node, int *depth) {
+    leaf_node_t *leaf = (leaf_node_t *)node -> node;
+
+    // Errors still produce -1 as the value, just like eval_tree
+    if (node -> type != LEAF || leaf == NULL) {
+        if (emit(prog, OP_ERROR, MISSING_LVALUE, NULL) < 0) {
+            return -1;
+        }
+        adjust_depth(prog, depth, 1);
+        return emit(prog, OP_PUSH, -1, NULL) < 0 ? -1 : 0;
+    }
+
+    adjust_depth(prog, depth, 1);
+    switch (leaf -> exp_type) {
+        case INTEGER:
+            // The literal was decoded by the tokenizer
+            return emit(prog, OP_PUSH, leaf -> value, NULL) < 0 ? -1 : 0;
+        case SYMBOL:
+            return emit(prog, OP_LOAD, 0, node -> token) < 0 ? -1 : 0;
+        default:
+            if (emit(prog, OP_ERROR, UNKNOWN_EXP_TYPE, NULL) < 0) {
+                return -1;
+            }
+            return emit(prog, OP_PUSH, -1, NULL) < 0 ? -1 : 0;
+    }
+}
+
+// Markers on compile_node's work stack, only their addresses matter.
+// OPERATE and THEN are above the node they are for, ELSE and END are
+// on their own.
+static char operate_marker, then_marker, else_marker, end_marker;
+#define OPERATE ((void *)&operate_marker)   // the operands are compiled
+#define THEN ((void *)&then_marker)         // the condition of a ? is compiled
+#define ELSE ((void *)&else_marker)         // the true branch is compiled
+#define END ((void *)&end_marker)           // the false branch is compiled
+
+/// Compiles down the operands that run first, leaving each interior
+/// node on the way on the work stack under what is left of it
+///
+/// @param prog The program to add to
+/// @param work The work stack of compile_node
+/// @param node The node to start from
+/// @param depth The depth of the value stack before the node runs
+/// @return Returns 0 on success, -1 if out of memory
+static int descend(program_t *prog, stack_t *work, tree_node_t *node, int *depth) {
+    while (node -> type == INTERIOR) {
+        interior_node_t *interior = (interior_node_t *)node -> node;
+
+        switch (interior -> op) {
+            case ADD_OP:
+            case SUB_OP:
+            case MUL_OP:
+                // eval_tree evaluates the left side first for these
+                push(work, node);
+                push(work, OPERATE);
+                push(work, interior -> right);
+                node = interior -> left;
+                break;
+            case DIV_OP:
+            case MOD_OP:
+                // but the right side first for these, so left ends up on top
+                push(work, node);
+                push(work, OPERATE);
+                push(work, interior -> left);
+                node = interior -> right;
+                break;
+            case ASSIGN_OP:
+                // The error is raised but the assignment still happens
+                if (interior -> left -> type != LEAF &&
+                    emit(prog, OP_ERROR, INVALID_LVALUE, NULL) < 0) {
+                    return -1;
+                }
+                push(work, node);
+                push(work, OPERATE);
+                node = interior -> right;
+                break;
+            case Q_OP:
+                push(work, node);
+                push(work, THEN);
+                node = interior -> left;
+                break;
+            case ALT_OP:
+            case NO_OP:
+            default:
+                if (emit(prog, OP_ERROR, UNKNOWN_OPERATION, NULL) < 0) {
+                    return -1;
+                }
+                adjust_depth(prog, depth, 1);
+                return emit(prog, OP_PUSH, -1, NULL) < 0 ? -1 : 0;
+        }
+    }
+    return compile_leaf(prog, node, depth);
+}
+
+/// Emits the operation of an interior node whose operands are compiled
+///
+/// @param prog The program to add to
+/// @param node The node
+/// @param depth The depth of the value stack with the operands on it
+/// @return Returns 0 on success, -1 if out of memory
+static int emit_operation(program_t *prog, tree_node_t *node, int *depth) {
+    interior_node_t *interior = (interior_node_t *)node -> node;
+    opcode_t op;
+
+    switch (interior -> op) {
+        case ADD_OP:
+            op = OP_ADD;
+            break;
+        case SUB_OP:
+            op = OP_SUB;
+            break;
+        case MUL_OP:
+            op = OP_MUL;
+            break;
+        case DIV_OP:
+            op = OP_DIV;
+            break;
+        case MOD_OP:
+            op = OP_MOD;
+            break;
+        default:
+            // Only an assignment is left, which keeps its value
+            return emit(prog, OP_STORE, 0, interior -> left -> token) < 0 ? -1 : 0;
+    }
+    adjust_depth(prog, depth, -1);
+    return emit(prog, op, 0, NULL) < 0 ? -1 : 0;
+}
+
+/// Emits the code for a tree, mirroring what eval_tree does for it.
+/// The nodes still to finish are on an explicit stack, so no depth of
+/// tree can run out of native stack.
+///
+/// @param prog The program to add to
+/// @param node The root of the tree to compile
+/// @param depth The depth of the value stack before the tree runs
+/// @return Returns 0 on success, -1 if out of memory
+static int compile_node(program_t *prog, tree_node_t *node, int *depth) {
+    void *slots[STACK_LOCAL];
+    stack_t work;
+
+    // The jumps of the ?s being compiled are patched once their
+    // targets are known.  Until then each holds the index of the one
+    // before it, so they form a stack of their own with pending on top.
+    int pending = -1;
+
+    init_stack(&work, STACK_BORROWS, slots, STACK_LOCAL);
+    int result = descend(prog, &work, node, depth);
+    while (result == 0 && work.size > 0) {
+        void *item = work.data[--work.size];
+
+        if (item == OPERATE) {
+            node = (tree_node_t *)work.data[--work.size];
+            result = emit_operation(prog, node, depth);
+        }
+        else if (item == THEN) {
+            node = (tree_node_t *)work.data[--work.size];
+            interior_node_t *alt = (interior_node_t *)((interior_node_t *)node -> node) -> right -> node;
+
+            adjust_depth(prog, depth, -1);
+            pending = emit(prog, OP_JUMP_ZERO, pending, NULL);
+            if (pending < 0) {
+                result = -1;
+                break;
+            }
+            push(&work, END);
+            push(&work, alt -> right);
+            push(&work, ELSE);
+            result = descend(prog, &work, alt -> left, depth);
+        }
+        else if (item == ELSE) {
+            // Only one branch runs, so the else starts from the same depth
+            int to_else = pending;
+            pending = emit(prog, OP_JUMP, prog -> code[to_else].arg, NULL);
+            if (pending < 0) {
+                result = -1;
+                break;
+            }
+            adjust_depth(prog, depth, -1);
+            prog -> code[to_else].arg = prog -> length;
+        }
+        else if (item == END) {
+            int to_end = pending;
+            pending = prog -> code[to_end].arg;
+            prog -> code[to_end].arg = prog -> length;
+        }
+        else {
+            result = descend(prog, &work, (tree_node_t *)item, depth);
+        }
+    }
+    release_stack(&work);
+    return result;
+}
+
+int compile_tree(program_t *prog, tree_node_t *tree) {
+    int depth = 0;
+
+    prog -> length = 0;
+    prog -> max_depth = 0;
+
+    // Nothing is bound yet, so the program fits any context's table
+    prog -> version = 0;
+
+    if (compile_node(prog, tree, &depth) < 0) {
+        return -1;
+    }
+    return emit(prog, OP_HALT, 0, NULL) < 0 ? -1 : 0;
+}
+
+void free_program(program_t *prog) {
+    tracked_free(prog -> code);
+    init_program(prog);
+}
+
+void init_vm(vm_t *vm) {
+    vm -> stack = NULL;
+    vm -> size = 0;
+}
+
+/// Binds a value to the symbol of an OP_STORE, creating the symbol
+/// if needed
+///
+/// @param ctx The context whose symbols are used
+/// @param instr The OP_STORE, bound to the symbol once it is found
+/// @param value The value to bind
+/// @return Returns EVAL_NONE, or SYMTAB_FULL if the symbol could not be made
+static eval_error_t store_symbol(context_t *ctx, instr_t *instr, int value) {
+    char *name = instr -> name;
+
+    if (instr -> symbol == NULL) {
+        instr -> symbol = ctx_lookup_table(ctx, name);
+    }
+    if (instr -> symbol && ctx -> reader) {
+        ctx_shared_assign(ctx, instr -> symbol, value);
+        return EVAL_NONE;
+    }
+    if (instr -> symbol) {
+        instr -> symbol -> val = value;
+        return EVAL_NONE;
+    }
+    instr -> symbol = ctx_create_symbol(ctx, name, value);
+    return instr -> symbol ? EVAL_NONE : SYMTAB_FULL;
+}
+
+void reserve_vm(vm_t *vm, int depth) {
+    if (vm -> size < depth) {
+        int *stack = (int *)tracked_realloc(vm -> stack, depth * sizeof(int));
+        if (stack == NULL) {
+            fprintf(stderr, "Out of memory for the value stack\n");
+            exit(EXIT_FAILURE);
+        }
+        vm -> stack = stack;
+        vm -> size = depth;
+    }
+}
+
+int ctx_run_program(context_t *ctx, vm_t *vm, program_t *prog, eval_error_t *error) {
+    reserve_vm(vm, prog -> max_depth);
+
+    instr_t *code = prog -> code;
+    int *sp = vm -> stack;      // the next free slot
+
+    // Bindings made before the table was rebuilt may be to freed symbols
+    unsigned long version = ctx_table_version(ctx);
+    if (prog -> version != version) {
+        for (int i = 0; i < prog -> length; i++) {
+            code[i].symbol = NULL;
+        }
+        prog -> version = version;
+    }
+    int pc = 0, left, right;
+
+    *error = EVAL_NONE;
+
+    for (;;) {
+        instr_t *instr = &code[pc++];
+
+        switch (instr -> op) {
+            case OP_PUSH:
+                *sp++ = instr -> arg;
+                break;
+            case OP_LOAD: {
+                symbol_t *sym = instr -> symbol;
+                if (sym == NULL) {
+                    sym = instr -> symbol = ctx_lookup_table(ctx, instr -> name);
+                }
+                if (sym == NULL) {
+                    *error = UNDEFINED_SYMBOL;
+                    *sp++ = -1;
+                }
+                else {
+                    *sp++ = ctx -> reader ? ctx_shared_value(ctx, sym) : sym -> val;
+                }
+                break;
+            }
+            case OP_STORE: {
+                eval_error_t store_error = store_symbol(ctx, instr, sp[-1]);
+                if (store_error != EVAL_NONE) {
+                    *error = store_error;
+                }
+                break;
+            }
+            case OP_ADD:
+                right = *--sp;
+                sp[-1] += right;
+                break;
+            case OP_SUB:
+                right = *--sp;
+                sp[-1] -= right;
+                break;
+            case OP_MUL:
+                right = *--sp;
+                sp[-1] *= right;
+                break;
+            case OP_DIV:
+                left = *--sp;
+                right = sp[-1];
+                if (right == 0) {
+                    *error = DIVISION_BY_ZERO;
+                    sp[-1] = -1;
+                }
+                // INT_MIN / -1 traps, so -1 negates with wrap around instead
+                else if (right == -1) {
+                    sp[-1] = (int)(0u - (unsigned int)left);
+                }
+                else {
+                    sp[-1] = left / right;
+                }
+                break;
+            case OP_MOD:
+                left = *--sp;
+                right = sp[-1];
+                if (right == 0) {
+                    *error = INVALID_MODULUS;
+                    sp[-1] = -1;
+                }
+                else if (right == -1) {
+                    sp[-1] = 0;
+                }
+                else {
+                    sp[-1] = left % right;
+                }
+                break;
+            case OP_JUMP_ZERO:
+                if (*--sp == 0) {
+                    pc = instr -> arg;
+                }
+                break;
+            case OP_JUMP:
+                pc = instr -> arg;
+                break;
+            case OP_ERROR:
+                *error = (eval_error_t)instr -> arg;
+                break;
+            case OP_HALT:
+                return sp[-1];
+        }
+    }
+}
+
+int run_program(vm_t *vm, program_t *prog, eval_error_t *error) {
+    return ctx_run_program(&default_context, vm, prog, error);
+}
+
+void free_vm(vm_t *vm) {
+    tracked_free(vm -> stack);
+    init_vm(vm);
+}
@@ -0,0 +1,92 @@
+// Flat bytecode for expression trees and the stack machine that runs it
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "parser.h"
+#include "symtab.h"
+
+/// The instructions of the stack machine
+typedef enum opcode_e {
+    OP_PUSH,                    ///< push the integer in arg
+    OP_LOAD,                    ///< push the value bound to name
+    OP_STORE,                   ///< bind the top of the stack to name, leaving it there
+    OP_ADD,                     ///< pop right then left, push left + right
+    OP_SUB,                     ///< pop right then left, push left - right
+    OP_MUL,                     ///< pop right then left, push left * right
+    OP_DIV,                     ///< pop left then right, push left / right
+    OP_MOD,                     ///< pop left then right, push left % right
+    OP_JUMP_ZERO,               ///< pop, and jump to arg if it was zero
+    OP_JUMP,                    ///< jump to arg
+    OP_ERROR,                   ///< set the eval error to arg
+    OP_HALT                     ///< stop, the result is on top of the stack
+} opcode_t;
+
+/// A single instruction
+typedef struct instr_s {
+    opcode_t op;                ///< what to do
+    int arg;                    ///< the immediate, jump target or error
+    char *name;                 ///< the symbol for OP_LOAD and OP_STORE
+    symbol_t *symbol;           ///< the symbol name was bound to (NULL until found)
+} instr_t;
+
+/// A compiled expression
+typedef struct program_s {
+    instr_t *code;              ///< the instructions, ending with OP_HALT
+    int length;                 ///< the number of instructions
+    int capacity;               ///< the number of instructions allocated
+    int max_depth;              ///< the deepest the value stack can get
+    unsigned long version;      ///< the table_version the symbols were bound in (0 before any are)
+} program_t;
+
+/// The value stack of the machine, reusable across runs
+typedef struct vm_s {
+    int *stack;                 ///< the values
+    int size;                   ///< the number of values allocated
+} vm_t;
+
+/// Initializes an empty program
+/// @param prog The program to initialize
+void init_program(program_t *prog);
+
+/// Compiles the expression tree into a program, replacing whatever
+/// the program held before.  Symbol names are not copied, so a program
+/// kept after the tree is freed needs its own copies of them.
+/// @param prog The program to compile into
+/// @param tree The root of a tree without parse errors
+/// @return 0 on success, -1 if memory could not be allocated
+int compile_tree(program_t *prog, tree_node_t *tree);
+
+/// Releases the instructions of a program
+/// @param prog The program to free
+void free_program(program_t *prog);
+
+/// Initializes a machine with an empty stack
+/// @param vm The machine to initialize
+void init_vm(vm_t *vm);
+
+/// Makes sure a machine's stack can hold depth values
+/// @param vm The machine
+/// @param depth The number of values
+/// @exception If the stack can't be grown, an error message is
+///     displayed to standard error and the program exits with EXIT_FAILURE
+void reserve_vm(vm_t *vm, int depth);
+
+/// Runs a compiled program.  The results and errors are exactly those
+/// eval_tree gives for the tree the program was compiled from; as there,
+/// an error does not stop evaluation and the last one raised wins.
+/// Each OP_LOAD and OP_STORE binds to its symbol the first time it
+/// finds it, so a program run again reads and writes the value
+/// directly.  A symbol that isn't there yet is looked for every run,
+/// and the bindings are dropped whenever the table's version changes.
+/// @param vm The machine to run the program on
+/// @param prog The program to run
+/// @param error Set to the eval error, or EVAL_NONE
+/// @return the value of the expression
+int run_program(vm_t *vm, program_t *prog, eval_error_t *error);
+
+/// Releases the stack of a machine
+/// @param vm The machine to free
+void free_vm(vm_t *vm);
+
+#endif
@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+#include "alloc.h"
+
+static cache_entry_t **buckets;
+static int num_buckets;         // a power of two, at least the capacity
+static cache_entry_t *newest, *oldest;
+static cache_stats_t counts;
+
+void init_cache(int capacity) {
+    if (capacity <= 0) {
+        return;
+    }
+    num_buckets = 1;
+    while (num_buckets < capacity) {
+        num_buckets *= 2;
+    }
+    buckets = (cache_entry_t **)tracked_calloc(num_buckets, sizeof(cache_entry_t *));
+    if (buckets == NULL) {
+        num_buckets = 0;
+        return;
+    }
+    counts.capacity = capacity;
+}
+
+int cache_enabled(void) {
+    return buckets != NULL;
+}
+
+int cache_key(const char *exp, size_t *len) {
+    const char *comment = strchr(exp, '#');
+
+    if (comment == NULL) {
+        *len = strlen(exp);
+        return 0;
+    }
+    if (strchr(comment, '\n') != NULL) {
+        return -1;
+    }
+    // The # stays in the key, as a token it ends may parse differently
+    // from the same token at the end of the line
+    *len = comment - exp + 1;
+    return 0;
+}
+
+/// Hashes the key, FNV-1a like the symbol names
+///
+/// @param key The characters of the key
+/// @param len The number of characters
+/// @return Returns the hash
+static unsigned int hash_key(const char *key, size_t len) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/// Takes an entry out of the recently used list
+///
+/// @param entry The entry to unlink
+static void unlink_entry(cache_entry_t *entry) {
+    if (entry -> newer) {
+        entry -> newer -> older = entry -> older;
+    }
+    else {
+        newest = entry -> older;
+    }
+    if (entry -> older) {
+        entry -> older -> newer = entry -> newer;
+    }
+    else {
+        oldest = entry -> newer;
+    }
+}
+
+/// Puts an entry at the most recently used end of the list
+///
+/// @param entry The entry to add
+static void make_newest(cache_entry_t *entry) {
+    entry -> newer = NULL;
+    entry -> older = newest;
+    if (newest) {
+        newest -> newer = entry;
+    }
+    newest = entry;
+    if (oldest == NULL) {
+        oldest = entry;
+    }
+}
+
+cache_entry_t *find_cached(const char *key, size_t len) {
+    unsigned int hash = hash_key(key, len);
+    cache_entry_t *entry = buckets[hash & (num_buckets - 1)];
+
+    while (entry && (entry -> hash != hash || entry -> key_len != len ||
+                     memcmp(entry -> key, key, len))) {
+        entry = entry -> chain;
+    }
+
+    if (entry == NULL) {
+        counts.misses++;
+        return NULL;
+    }
+    counts.hits++;
+    unlink_entry(entry);
+    make_newest(entry);
+    return entry;
+}
+
+/// Removes an entry from its bucket and the list, and frees it
+///
+/// @param entry The entry to drop
+static void drop_entry(cache_entry_t *entry) {
+    cache_entry_t **link = &buckets[entry -> hash & (num_buckets - 1)];
+
+    while (*link != entry) {
+        link = &(*link) -> chain;
+    }
+    *link = entry -> chain;
+    unlink_entry(entry);
+    free_program(&entry -> program);
+    free_jit(&entry -> jit);
+    tracked_free(entry);
+    counts.entries--;
+}
+
+cache_entry_t *add_cached(const char *key, size_t len, parse_error_t error,
+                          program_t *prog, tree_node_t *tree) {
+    // The key, infix text and symbol names all go in one block after the entry
+    size_t infix_len = error == PARSE_NONE ? infix_length(tree) : 0;
+    size_t size = sizeof(cache_entry_t) + len + 1 + infix_len + 1;
+    int length = error == PARSE_NONE ? prog -> length : 0;
+
+    for (int i = 0; i < length; i++) {
+        if (prog -> code[i].name) {
+            size += strlen(prog -> code[i].name) + 1;
+        }
+    }
+
+    cache_entry_t *entry = (cache_entry_t *)tracked_malloc(size);
+    if (entry == NULL) {
+        return NULL;
+    }
+    init_program(&entry -> program);
+    init_jit(&entry -> jit);
+    entry -> jit_tried = 0;
+    if (length) {
+        entry -> program.code = (instr_t *)tracked_malloc(sizeof(instr_t) * length);
+        if (entry -> program.code == NULL) {
+            tracked_free(entry);
+            return NULL;
+        }
+    }
+
+    char *strings = (char *)(entry + 1);
+    entry -> key = strings;
+    memcpy(entry -> key, key, len);
+    entry -> key[len] = '\0';
+    entry -> key_len = len;
+    entry -> hash = hash_key(key, len);
+    entry -> parse_error = error;
+    strings += len + 1;
+
+    entry -> infix = strings;
+    if (error == PARSE_NONE) {
+        strings = format_infix(tree, strings);
+    }
+    *strings++ = '\0';
+
+    // Copy the program with names that don't point into the parse arena
+    if (length) {
+        memcpy(entry -> program.code, prog -> code, sizeof(instr_t) * length);
+        entry -> program.length = length;
+        entry -> program.capacity = length;
+        entry -> program.max_depth = prog -> max_depth;
+        entry -> program.version = prog -> version;
+        for (int i = 0; i < length; i++) {
+            if (prog -> code[i].name) {
+                entry -> program.code[i].name = strcpy(strings, prog -> code[i].name);
+                strings += strlen(strings) + 1;
+            }
+        }
+    }
+
+    if (counts.entries == counts.capacity) {
+        drop_entry(oldest);
+        counts.evictions++;
+    }
+
+    cache_entry_t **bucket = &buckets[entry -> hash & (num_buckets - 1)];
+    entry -> chain = *bucket;
+    *bucket = entry;
+    make_newest(entry);
+    counts.entries++;
+    return entry;
+}
+
+void get_cache_stats(cache_stats_t *out) {
+    *out = counts;
+}
+
+void free_cache(void) {
+    while (oldest) {
+        drop_entry(oldest);
+    }
+    tracked_free(buckets);
+    buckets = NULL;
+    num_buckets = 0;
+    counts.capacity = 0;
+}
@@ -0,0 +1,76 @@
+// Least recently used cache of compiled expressions, keyed by their text
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include "bytecode.h"
+#include "jit.h"
+
+/// A compiled line, and everything needed to print its result
+typedef struct cache_entry_s {
+    char *key;                  ///< the text of the line, up to any comment
+    size_t key_len;             ///< the number of characters in key
+    unsigned int hash;          ///< the hash of key
+    parse_error_t parse_error;  ///< the error from parsing, if any
+    program_t program;          ///< the compiled line, with names in the entry's block
+    jit_code_t jit;             ///< the line as machine code, once it has been reused
+    int jit_tried;              ///< whether compiling it to machine code was tried
+    char *infix;                ///< what print_infix displays for the line
+    struct cache_entry_s *newer;    ///< the entry used after this one
+    struct cache_entry_s *older;    ///< the entry used before this one
+    struct cache_entry_s *chain;    ///< the next entry in the same bucket
+} cache_entry_t;
+
+/// How well the cache is doing
+typedef struct cache_stats_s {
+    long hits;                  ///< lines found in the cache
+    long misses;                ///< lines that had to be parsed
+    long evictions;             ///< entries dropped to make room
+    int entries;                ///< entries in the cache now
+    int capacity;               ///< the most entries it will hold
+} cache_stats_t;
+
+/// Turns the cache on
+/// @param capacity The most lines to keep, 0 leaves the cache off
+void init_cache(int capacity);
+
+/// Tells whether the cache is on
+/// @return true if init_cache was given a capacity
+int cache_enabled(void);
+
+/// Finds the part of a line that decides how it parses: everything
+/// up to and including the # of a comment, as "1a#" is 1 but "1a" is
+/// an illegal token.  Lines with a newline after the comment are not
+/// cached (the tokens after it would count).
+/// @param exp The line
+/// @param len Set to the length of the key
+/// @return 0 if the line can be cached, -1 if not
+int cache_key(const char *exp, size_t *len);
+
+/// Looks up a line, making it the most recently used
+/// @param key The key from cache_key
+/// @param len The length of the key
+/// @return the entry, or NULL if the line isn't cached
+cache_entry_t *find_cached(const char *key, size_t len);
+
+/// Adds a line to the cache, dropping the least recently used entry if
+/// the cache is full.  The program and tree are copied, so the entry
+/// stays valid after the parse arena is reset.
+/// @param key The key from cache_key
+/// @param len The length of the key
+/// @param error The error from parsing the line
+/// @param prog The compiled line (ignored if error isn't PARSE_NONE)
+/// @param tree The tree the line parsed to (ignored on an error)
+/// @return the new entry, or NULL if it could not be allocated
+cache_entry_t *add_cached(const char *key, size_t len, parse_error_t error,
+                          program_t *prog, tree_node_t *tree);
+
+/// Gets the hit, miss and size counts of the cache
+/// @param stats Filled in with the counts
+void get_cache_stats(cache_stats_t *stats);
+
+/// Empties the cache and turns it off
+void free_cache(void);
+
+#endif
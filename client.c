@@ -0,0 +1,370 @@
+/// A client for interp --serve, and a load generator for it.
+///
+/// Usage: client socket
+///        client socket --load clients lines [window]
+///
+/// With just the socket, the lines on standard input are sent to the
+/// server as fast as it takes them, without waiting for replies, and
+/// the replies are copied to standard output.  With --load, that many
+/// clients connect at once and each sends that many lines, with at
+/// most window of them (default 64) waiting for replies.  Every reply
+/// is checked against what a server printing text should send back,
+/// which only comes out right if each client's lines are evaluated in
+/// order.  The throughput and reply times are printed as one line on
+/// standard output.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CLIENT_BLOCK (1 << 16)  // bytes read or written at a time
+#define MAX_LINE_BYTES 64       // longest generated line or reply
+#define ERROR_EVERY 16          // every this many lines is a division by zero
+
+/// One of the load generator's connections
+typedef struct conn_s {
+    int fd;                     ///< the socket, -1 once every reply is in
+    int id;                     ///< which client, the symbol it uses is c<id>
+    long sent;                  ///< the lines sent so far
+    long replied;               ///< the replies checked so far
+    char *out;                  ///< lines waiting to be sent
+    size_t out_len;             ///< the number of bytes in out
+    char in[CLIENT_BLOCK];      ///< replies read and not yet checked
+    size_t in_len;              ///< the number of bytes in in
+    double *sent_at;            ///< when each waiting line was sent, by line % window
+} conn_t;
+
+static long mismatches;
+static double total_wait, max_wait;
+
+/// Reads the clock
+///
+/// @return Returns the time in seconds
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// Connects to the server, then makes the socket non-blocking
+///
+/// @param path The server's socket
+/// @return Returns the connected socket
+static int connect_to(char *path) {
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/// Writes all of a buffer to a blocking descriptor
+///
+/// @param fd Where to write
+/// @param text The bytes
+/// @param len The number of bytes
+static void write_all(int fd, const char *text, size_t len) {
+    while (len > 0) {
+        ssize_t wrote = write(fd, text, len);
+        if (wrote < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error writing the replies");
+            exit(EXIT_FAILURE);
+        }
+        text += wrote;
+        len -= wrote;
+    }
+}
+
+/// Sends standard input to the server and copies the replies to
+/// standard output, until the server has replied to everything
+///
+/// @param fd The connected socket
+static void pipe_lines(int fd) {
+    static char in[CLIENT_BLOCK], reply[CLIENT_BLOCK];
+    size_t in_len = 0, in_sent = 0;
+    int input_done = 0;
+
+    for (;;) {
+        struct pollfd fds[2];
+
+        // Standard input is only read once the last of it is sent
+        fds[0].fd = input_done || in_len ? -1 : STDIN_FILENO;
+        fds[0].events = POLLIN;
+        fds[1].fd = fd;
+        fds[1].events = POLLIN | (in_len ? POLLOUT : 0);
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error waiting for the server");
+            exit(EXIT_FAILURE);
+        }
+
+        if (fds[0].revents) {
+            ssize_t got = read(STDIN_FILENO, in, sizeof(in));
+            if (got < 0 && errno != EINTR) {
+                perror("Error reading the expressions");
+                exit(EXIT_FAILURE);
+            }
+            if (got == 0) {
+                input_done = 1;
+                shutdown(fd, SHUT_WR);
+            }
+            in_len = got > 0 ? got : 0;
+            in_sent = 0;
+        }
+        if (fds[1].revents & POLLOUT) {
+            ssize_t wrote = send(fd, in + in_sent, in_len - in_sent, MSG_NOSIGNAL);
+            if (wrote < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Error sending the expressions");
+                exit(EXIT_FAILURE);
+            }
+            in_sent += wrote > 0 ? wrote : 0;
+            if (in_sent == in_len) {
+                in_len = in_sent = 0;
+            }
+        }
+        if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t got = read(fd, reply, sizeof(reply));
+            if (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("Error reading the replies");
+                exit(EXIT_FAILURE);
+            }
+
+            // The server closes the connection after the last reply
+            if (got == 0) {
+                return;
+            }
+            write_all(STDOUT_FILENO, reply, got > 0 ? got : 0);
+        }
+    }
+}
+
+/// Makes one of a client's lines.  Each line reads what the one before
+/// it assigned, so its reply is only right if they run in order.
+///
+/// @param dst Where to write it, at least MAX_LINE_BYTES
+/// @param id The client
+/// @param k Which of its lines
+/// @return Returns the number of characters written
+static int make_line(char *dst, int id, long k) {
+    if (k % ERROR_EVERY == ERROR_EVERY - 1) {
+        return sprintf(dst, "c%d 0 /\n", id);
+    }
+    if (k % 2 == 0) {
+        return sprintf(dst, "c%d %ld =\n", id, k);
+    }
+    return sprintf(dst, "c%d 1 +\n", id);
+}
+
+/// Makes the reply the server should send for a line from make_line
+///
+/// @param dst Where to write it, at least MAX_LINE_BYTES
+/// @param id The client
+/// @param k Which of its lines
+static void expected_reply(char *dst, int id, long k) {
+    if (k % ERROR_EVERY == ERROR_EVERY - 1) {
+        strcpy(dst, "Division by zero");
+    }
+    else if (k % 2 == 0) {
+        sprintf(dst, "(c%d=%ld) = %ld", id, k, k);
+    }
+    else {
+        sprintf(dst, "(c%d+1) = %ld", id, k);
+    }
+}
+
+/// Sends a connection's next lines, keeping at most window waiting
+///
+/// @param conn The connection
+/// @param lines The number of lines it sends in all
+/// @param window The most lines waiting for replies
+static void send_lines(conn_t *conn, long lines, long window) {
+    while (conn -> sent < lines && conn -> sent - conn -> replied < window) {
+        conn -> sent_at[conn -> sent % window] = now();
+        conn -> out_len += make_line(conn -> out + conn -> out_len, conn -> id, conn -> sent);
+        conn -> sent++;
+    }
+
+    ssize_t wrote = conn -> out_len ? send(conn -> fd, conn -> out, conn -> out_len, MSG_NOSIGNAL) : 0;
+    if (wrote < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return;
+        }
+        perror("Error sending the expressions");
+        exit(EXIT_FAILURE);
+    }
+    conn -> out_len -= wrote;
+    memmove(conn -> out, conn -> out + wrote, conn -> out_len);
+}
+
+/// Reads and checks a connection's replies
+///
+/// @param conn The connection
+/// @param lines The number of lines it sends in all
+/// @param window The most lines waiting for replies
+static void check_replies(conn_t *conn, long lines, long window) {
+    char expected[MAX_LINE_BYTES];
+    ssize_t got = read(conn -> fd, conn -> in + conn -> in_len, sizeof(conn -> in) - conn -> in_len);
+
+    if (got < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return;
+        }
+        perror("Error reading the replies");
+        exit(EXIT_FAILURE);
+    }
+    if (got == 0) {
+        fprintf(stderr, "The server closed client %d after %ld of %ld replies\n",
+                conn -> id, conn -> replied, lines);
+        exit(EXIT_FAILURE);
+    }
+    conn -> in_len += got;
+
+    char *line = conn -> in, *end = conn -> in + conn -> in_len, *newline;
+    double time = now();
+    while ((newline = memchr(line, '\n', end - line)) != NULL) {
+        *newline = '\0';
+        if (conn -> replied == conn -> sent) {
+            fprintf(stderr, "Client %d got a reply it didn't ask for: %s\n", conn -> id, line);
+            exit(EXIT_FAILURE);
+        }
+        expected_reply(expected, conn -> id, conn -> replied);
+        if (strcmp(line, expected)) {
+            if (mismatches++ < 10) {
+                fprintf(stderr, "Client %d line %ld: expected \"%s\", got \"%s\"\n",
+                        conn -> id, conn -> replied, expected, line);
+            }
+        }
+        double wait = time - conn -> sent_at[conn -> replied % window];
+        total_wait += wait;
+        if (wait > max_wait) {
+            max_wait = wait;
+        }
+        conn -> replied++;
+        line = newline + 1;
+    }
+    conn -> in_len = end - line;
+    memmove(conn -> in, line, conn -> in_len);
+    if (conn -> in_len == sizeof(conn -> in)) {
+        fprintf(stderr, "Client %d got a reply too long to check\n", conn -> id);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/// Runs the load generator
+///
+/// @param path The server's socket
+/// @param clients The number of clients
+/// @param lines The number of lines each sends
+/// @param window The most lines each has waiting for replies
+/// @return Returns EXIT_SUCCESS if every reply was right
+static int generate_load(char *path, int clients, long lines, long window) {
+    conn_t *conns = (conn_t *)calloc(clients, sizeof(conn_t));
+    struct pollfd *fds = (struct pollfd *)calloc(clients, sizeof(struct pollfd));
+
+    if (conns == NULL || fds == NULL) {
+        fprintf(stderr, "Could not allocate memory for the clients\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < clients; i++) {
+        conns[i].fd = connect_to(path);
+        conns[i].id = i;
+        conns[i].out = (char *)malloc(window * MAX_LINE_BYTES);
+        conns[i].sent_at = (double *)malloc(sizeof(double) * window);
+        if (conns[i].out == NULL || conns[i].sent_at == NULL) {
+            fprintf(stderr, "Could not allocate memory for the clients\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    double start = now();
+    int active = clients;
+    while (active) {
+        for (int i = 0; i < clients; i++) {
+            conn_t *conn = &conns[i];
+            if (conn -> fd >= 0) {
+                send_lines(conn, lines, window);
+            }
+            fds[i].fd = conn -> fd;
+            fds[i].events = POLLIN | (conn -> out_len ? POLLOUT : 0);
+        }
+        if (poll(fds, clients, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Error waiting for the server");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < clients; i++) {
+            conn_t *conn = &conns[i];
+            if (conn -> fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            check_replies(conn, lines, window);
+            if (conn -> replied == lines) {
+                close(conn -> fd);
+                conn -> fd = -1;
+                active--;
+            }
+        }
+    }
+    double seconds = now() - start;
+
+    long total = clients * lines;
+    printf("{\"clients\": %d, \"lines\": %ld, \"window\": %ld, \"seconds\": %.3f, "
+           "\"lines_per_second\": %.0f, \"mean_reply_us\": %.1f, \"max_reply_us\": %.1f, "
+           "\"mismatches\": %ld}\n",
+           clients, total, window, seconds, total / seconds,
+           total ? total_wait / total * 1e6 : 0.0, max_wait * 1e6, mismatches);
+
+    for (int i = 0; i < clients; i++) {
+        free(conns[i].out);
+        free(conns[i].sent_at);
+    }
+    free(conns);
+    free(fds);
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 2) {
+        pipe_lines(connect_to(argv[1]));
+        return 0;
+    }
+
+    int clients;
+    long lines, window = 64;
+    if ((argc != 5 && argc != 6) || strcmp(argv[2], "--load") ||
+        (clients = atoi(argv[3])) < 1 || (lines = atol(argv[4])) < 1 ||
+        (argc == 6 && (window = atol(argv[5])) < 1)) {
+        fprintf(stderr, "Usage: client socket\n       client socket --load clients lines [window]\n");
+        exit(EXIT_FAILURE);
+    }
+    return generate_load(argv[1], clients, lines, window);
+}
@@ -0,0 +1,735 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "columnar.h"
+#include "alloc.h"
+#include "parser.h"
+#include "context.h"
+#include "arena.h"
+#include "bytecode.h"
+#include "optimize.h"
+#include "output.h"
+#include "stats.h"
+#include "symtab.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/// A column of the input, named after the symbol it gives values for
+typedef struct column_s {
+    char *name;                 ///< the symbol (points into the header line)
+    int *values;                ///< the value of each row
+} column_t;
+
+/// Every column of the input
+typedef struct columns_s {
+    column_t *columns;          ///< the columns, in the order of the header
+    int count;                  ///< the number of columns
+    long rows;                  ///< the number of rows in every column
+    long capacity;              ///< the number of rows allocated in every column
+    char *text;                 ///< the contents of the file
+} columns_t;
+
+/// The instructions of the column machine.  Every instruction works on
+/// a whole batch of rows, with a stack of masks saying which rows of
+/// the batch the instruction is really being evaluated for.
+typedef enum vec_op_e {
+    VEC_CONST,                  ///< push arg in every row
+    VEC_COLUMN,                 ///< push the column numbered arg
+    VEC_ADD,                    ///< pop right then left, push left + right
+    VEC_SUB,                    ///< pop right then left, push left - right
+    VEC_MUL,                    ///< pop right then left, push left * right
+    VEC_DIV,                    ///< pop left then right, push left / right
+    VEC_MOD,                    ///< pop left then right, push left % right
+    VEC_ERROR,                  ///< set the error of the masked rows to arg
+    VEC_BRANCH,                 ///< push a mask of the rows whose condition (on top) isn't zero
+    VEC_ELSE,                   ///< flip the mask to the rows whose condition was zero
+    VEC_SELECT,                 ///< pop both alternatives and the condition, push the chosen one and pop the mask
+    VEC_HALT                    ///< stop, the result is on top of the stack
+} vec_op_t;
+
+/// A single instruction of the column machine
+typedef struct vec_instr_s {
+    vec_op_t op;                ///< what to do
+    int arg;                    ///< the constant, column or error
+} vec_instr_t;
+
+/// An expression compiled for the column machine
+typedef struct vec_program_s {
+    vec_instr_t *code;          ///< the instructions, ending with VEC_HALT
+    int length;                 ///< the number of instructions
+    int max_depth;              ///< the deepest the value stack can get
+    int max_masks;              ///< the deepest the mask stack can get
+} vec_program_t;
+
+/// The batch operations, in whichever instruction set the processor has
+typedef struct kernels_s {
+    const char *name;           ///< the instruction set, for --stats
+    void (*add)(int *dst, const int *left, const int *right, int n);
+    void (*sub)(int *dst, const int *left, const int *right, int n);
+    void (*mul)(int *dst, const int *left, const int *right, int n);
+    void (*nonzero)(int *dst, const int *mask, const int *cond, int n);
+    void (*zero)(int *dst, const int *mask, const int *cond, int n);
+    void (*select)(int *dst, const int *cond, const int *left, const int *right, int n);
+} kernels_t;
+
+// Overflow wraps in every kernel, the same as it does for run_program
+
+static void add_scalar(int *dst, const int *left, const int *right, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = (int)((unsigned)left[i] + (unsigned)right[i]);
+    }
+}
+
+static void sub_scalar(int *dst, const int *left, const int *right, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = (int)((unsigned)left[i] - (unsigned)right[i]);
+    }
+}
+
+static void mul_scalar(int *dst, const int *left, const int *right, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = (int)((unsigned)left[i] * (unsigned)right[i]);
+    }
+}
+
+static void nonzero_scalar(int *dst, const int *mask, const int *cond, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = cond[i] != 0 ? mask[i] : 0;
+    }
+}
+
+static void zero_scalar(int *dst, const int *mask, const int *cond, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = cond[i] == 0 ? mask[i] : 0;
+    }
+}
+
+static void select_scalar(int *dst, const int *cond, const int *left, const int *right, int n) {
+    for (int i = 0; i < n; i++) {
+        dst[i] = cond[i] != 0 ? left[i] : right[i];
+    }
+}
+
+static const kernels_t scalar_kernels = {
+    "scalar", add_scalar, sub_scalar, mul_scalar,
+    nonzero_scalar, zero_scalar, select_scalar
+};
+
+#ifdef HAVE_X86_KERNELS
+
+// Each kernel does as many rows as fit in the registers, then leaves
+// the rest to the scalar version
+
+__attribute__((target("sse4.1")))
+static void add_sse(int *dst, const int *left, const int *right, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i l = _mm_loadu_si128((const __m128i *)(left + i));
+        __m128i r = _mm_loadu_si128((const __m128i *)(right + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi32(l, r));
+    }
+    add_scalar(dst + i, left + i, right + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void sub_sse(int *dst, const int *left, const int *right, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i l = _mm_loadu_si128((const __m128i *)(left + i));
+        __m128i r = _mm_loadu_si128((const __m128i *)(right + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_sub_epi32(l, r));
+    }
+    sub_scalar(dst + i, left + i, right + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void mul_sse(int *dst, const int *left, const int *right, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i l = _mm_loadu_si128((const __m128i *)(left + i));
+        __m128i r = _mm_loadu_si128((const __m128i *)(right + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_mullo_epi32(l, r));
+    }
+    mul_scalar(dst + i, left + i, right + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void nonzero_sse(int *dst, const int *mask, const int *cond, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+        __m128i c = _mm_loadu_si128((const __m128i *)(cond + i));
+        __m128i is_zero = _mm_cmpeq_epi32(c, _mm_setzero_si128());
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_andnot_si128(is_zero, m));
+    }
+    nonzero_scalar(dst + i, mask + i, cond + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void zero_sse(int *dst, const int *mask, const int *cond, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+        __m128i c = _mm_loadu_si128((const __m128i *)(cond + i));
+        __m128i is_zero = _mm_cmpeq_epi32(c, _mm_setzero_si128());
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_and_si128(is_zero, m));
+    }
+    zero_scalar(dst + i, mask + i, cond + i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void select_sse(int *dst, const int *cond, const int *left, const int *right, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(cond + i));
+        __m128i l = _mm_loadu_si128((const __m128i *)(left + i));
+        __m128i r = _mm_loadu_si128((const __m128i *)(right + i));
+        __m128i is_zero = _mm_cmpeq_epi32(c, _mm_setzero_si128());
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_blendv_epi8(l, r, is_zero));
+    }
+    select_scalar(dst + i, cond + i, left + i, right + i, n - i);
+}
+
+static const kernels_t sse_kernels = {
+    "sse4.1", add_sse, sub_sse, mul_sse,
+    nonzero_sse, zero_sse, select_sse
+};
+
+__attribute__((target("avx2")))
+static void add_avx2(int *dst, const int *left, const int *right, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i l = _mm256_loadu_si256((const __m256i *)(left + i));
+        __m256i r = _mm256_loadu_si256((const __m256i *)(right + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_add_epi32(l, r));
+    }
+    add_scalar(dst + i, left + i, right + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void sub_avx2(int *dst, const int *left, const int *right, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i l = _mm256_loadu_si256((const __m256i *)(left + i));
+        __m256i r = _mm256_loadu_si256((const __m256i *)(right + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_sub_epi32(l, r));
+    }
+    sub_scalar(dst + i, left + i, right + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void mul_avx2(int *dst, const int *left, const int *right, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i l = _mm256_loadu_si256((const __m256i *)(left + i));
+        __m256i r = _mm256_loadu_si256((const __m256i *)(right + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_mullo_epi32(l, r));
+    }
+    mul_scalar(dst + i, left + i, right + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void nonzero_avx2(int *dst, const int *mask, const int *cond, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i m = _mm256_loadu_si256((const __m256i *)(mask + i));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(cond + i));
+        __m256i is_zero = _mm256_cmpeq_epi32(c, _mm256_setzero_si256());
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_andnot_si256(is_zero, m));
+    }
+    nonzero_scalar(dst + i, mask + i, cond + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void zero_avx2(int *dst, const int *mask, const int *cond, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i m = _mm256_loadu_si256((const __m256i *)(mask + i));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(cond + i));
+        __m256i is_zero = _mm256_cmpeq_epi32(c, _mm256_setzero_si256());
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_and_si256(is_zero, m));
+    }
+    zero_scalar(dst + i, mask + i, cond + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void select_avx2(int *dst, const int *cond, const int *left, const int *right, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(cond + i));
+        __m256i l = _mm256_loadu_si256((const __m256i *)(left + i));
+        __m256i r = _mm256_loadu_si256((const __m256i *)(right + i));
+        __m256i is_zero = _mm256_cmpeq_epi32(c, _mm256_setzero_si256());
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_blendv_epi8(l, r, is_zero));
+    }
+    select_scalar(dst + i, cond + i, left + i, right + i, n - i);
+}
+
+static const kernels_t avx2_kernels = {
+    "avx2", add_avx2, sub_avx2, mul_avx2,
+    nonzero_avx2, zero_avx2, select_avx2
+};
+
+#endif
+
+/// Picks the widest kernels the processor can run
+///
+/// @return Returns the kernels to use
+static const kernels_t *choose_kernels(void) {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &avx2_kernels;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return &sse_kernels;
+    }
+#endif
+    return &scalar_kernels;
+}
+
+/// Divides a batch of rows.  There's no vector instruction for integer
+/// division, so this is always done a row at a time.  A zero divisor
+/// gives -1, and the error is only raised for the rows in the mask.
+///
+/// @param dst Where to put the results
+/// @param left The dividends
+/// @param right The divisors
+/// @param mask The rows being evaluated
+/// @param errors The error of each row
+/// @param modulus Whether to take the remainder instead of the quotient
+/// @param n The number of rows
+static void divide(int *dst, const int *left, const int *right, const int *mask,
+                   int *errors, int modulus, int n) {
+    eval_error_t error = modulus ? INVALID_MODULUS : DIVISION_BY_ZERO;
+
+    for (int i = 0; i < n; i++) {
+        int l = left[i], r = right[i];
+        if (r == 0) {
+            if (mask[i]) {
+                errors[i] = error;
+            }
+            dst[i] = -1;
+        }
+        // Rows not in the mask may divide anything, so this can't trap
+        else if (r == -1) {
+            dst[i] = modulus ? 0 : (int)(0u - (unsigned)l);
+        }
+        else {
+            dst[i] = modulus ? l % r : l / r;
+        }
+    }
+}
+
+/// Reads the whole of a file into memory
+///
+/// @param filename The file to read
+/// @return Returns the contents, null terminated
+static char *read_file(char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t size = 1 << 16, used = 0, got;
+    char *text = (char *)tracked_malloc(size + 1);
+    while (text && (got = fread(text + used, 1, size - used, fp)) > 0) {
+        used += got;
+        if (used == size) {
+            size *= 2;
+            char *bigger = (char *)tracked_realloc(text, size + 1);
+            if (bigger == NULL) {
+                tracked_free(text);
+            }
+            text = bigger;
+        }
+    }
+    if (text == NULL) {
+        fprintf(stderr, "Could not allocate memory for %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    if (ferror(fp)) {
+        fprintf(stderr, "Error reading %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+    text[used] = '\0';
+    return text;
+}
+
+/// Makes room for one more row in every column
+///
+/// @param cols The columns
+static void grow_columns(columns_t *cols) {
+    if (cols -> rows < cols -> capacity) {
+        return;
+    }
+    cols -> capacity = cols -> capacity ? cols -> capacity * 2 : COLUMN_BATCH;
+    for (int c = 0; c < cols -> count; c++) {
+        int *values = (int *)tracked_realloc(cols -> columns[c].values, cols -> capacity * sizeof(int));
+        if (values == NULL) {
+            fprintf(stderr, "Could not allocate memory for the columns\n");
+            exit(EXIT_FAILURE);
+        }
+        cols -> columns[c].values = values;
+    }
+}
+
+/// Loads a CSV file whose first line names the columns and whose
+/// other lines are rows of integers.  Blank lines are skipped.
+///
+/// @param cols The columns to fill
+/// @param filename The file to load
+static void load_columns(columns_t *cols, char *filename) {
+    char *text = read_file(filename), *line = text, *next;
+    long line_number = 1;
+
+    cols -> text = text;
+    cols -> count = 0;
+    cols -> rows = 0;
+    cols -> capacity = 0;
+
+    // The header is split in place, the names point into the text
+    next = line + strcspn(line, "\n");
+    if (*next) {
+        *next++ = '\0';
+    }
+    line[strcspn(line, "\r")] = '\0';
+    int fields = 1;
+    for (char *c = line; *c; c++) {
+        fields += *c == ',';
+    }
+    cols -> columns = (column_t *)tracked_calloc(fields, sizeof(column_t));
+    if (cols -> columns == NULL) {
+        fprintf(stderr, "Could not allocate memory for the columns\n");
+        exit(EXIT_FAILURE);
+    }
+    for (char *name = strtok(line, ","); name; name = strtok(NULL, ",")) {
+        cols -> columns[cols -> count++].name = name;
+    }
+    if (cols -> count != fields) {
+        fprintf(stderr, "%s: the header has an empty column name\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    for (line = next; *line; line = next) {
+        line_number++;
+        next = line + strcspn(line, "\n");
+        if (*next) {
+            *next++ = '\0';
+        }
+        line[strcspn(line, "\r")] = '\0';
+        if (*line == '\0') {
+            continue;
+        }
+
+        grow_columns(cols);
+        char *field = line, *end;
+        for (int c = 0; c < cols -> count; c++) {
+            long value = strtol(field, &end, 10);
+            if (end == field || (*end != ',' && *end != '\0') ||
+                (*end == '\0') != (c == cols -> count - 1)) {
+                fprintf(stderr, "%s: line %ld should have %d integers\n",
+                        filename, line_number, cols -> count);
+                exit(EXIT_FAILURE);
+            }
+            cols -> columns[c].values[cols -> rows] = (int)value;
+            field = end + 1;
+        }
+        cols -> rows++;
+    }
+}
+
+/// Releases everything load_columns allocated
+///
+/// @param cols The columns to free
+static void free_columns(columns_t *cols) {
+    for (int c = 0; c < cols -> count; c++) {
+        tracked_free(cols -> columns[c].values);
+    }
+    tracked_free(cols -> columns);
+    tracked_free(cols -> text);
+}
+
+/// Appends an instruction to a column program
+///
+/// @param prog The program to add to
+/// @param op The instruction
+/// @param arg The constant, column or error
+static void emit_vec(vec_program_t *prog, vec_op_t op, int arg) {
+    prog -> code[prog -> length].op = op;
+    prog -> code[prog -> length].arg = arg;
+    prog -> length++;
+}
+
+/// Translates a compiled program into one for the column machine.
+/// The jumps around the alternatives of each ? become masks, since
+/// different rows take different branches: both alternatives are
+/// evaluated for the whole batch, the errors of each only count for
+/// the rows that chose it, and then the chosen values are selected.
+///
+/// @param vec The program to fill
+/// @param prog The program for a single row
+/// @param cols The columns the symbols may name
+/// @return Returns 0 on success, -1 if the program assigns to a symbol
+static int compile_columns(vec_program_t *vec, program_t *prog, columns_t *cols) {
+    // An OP_LOAD can become an OP_ERROR as well, so allow two each
+    vec -> code = (vec_instr_t *)tracked_malloc(2 * prog -> length * sizeof(vec_instr_t));
+    int *ends = (int *)tracked_calloc(prog -> length + 1, sizeof(int));
+    if (vec -> code == NULL || ends == NULL) {
+        fprintf(stderr, "Could not allocate memory for the program\n");
+        exit(EXIT_FAILURE);
+    }
+    vec -> length = 0;
+    vec -> max_depth = 0;
+    vec -> max_masks = 1;
+
+    // Every alternative ends where the jump over the second one goes
+    for (int pc = 0; pc < prog -> length; pc++) {
+        if (prog -> code[pc].op == OP_JUMP) {
+            ends[prog -> code[pc].arg]++;
+        }
+    }
+
+    int depth = 0, masks = 1;
+    for (int pc = 0; pc < prog -> length; pc++) {
+        instr_t *instr = &prog -> code[pc];
+
+        // The condition stays on the stack under both alternatives
+        for (int i = 0; i < ends[pc]; i++) {
+            emit_vec(vec, VEC_SELECT, 0);
+            depth -= 2;
+            masks--;
+        }
+
+        switch (instr -> op) {
+            case OP_PUSH:
+                emit_vec(vec, VEC_CONST, instr -> arg);
+                depth++;
+                break;
+            case OP_LOAD: {
+                // Columns hide symbols of the same name in the table
+                int c = 0;
+                while (c < cols -> count && strcmp(cols -> columns[c].name, instr -> name)) {
+                    c++;
+                }
+                symbol_t *sym = c == cols -> count ? lookup_table(instr -> name) : NULL;
+                if (c < cols -> count) {
+                    emit_vec(vec, VEC_COLUMN, c);
+                }
+                else if (sym) {
+                    emit_vec(vec, VEC_CONST, sym -> val);
+                }
+                else {
+                    emit_vec(vec, VEC_ERROR, UNDEFINED_SYMBOL);
+                    emit_vec(vec, VEC_CONST, -1);
+                }
+                depth++;
+                break;
+            }
+            case OP_STORE:
+                tracked_free(ends);
+                return -1;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_MOD:
+                emit_vec(vec, instr -> op == OP_ADD ? VEC_ADD
+                            : instr -> op == OP_SUB ? VEC_SUB
+                            : instr -> op == OP_MUL ? VEC_MUL
+                            : instr -> op == OP_DIV ? VEC_DIV : VEC_MOD, 0);
+                depth--;
+                break;
+            case OP_JUMP_ZERO:
+                emit_vec(vec, VEC_BRANCH, 0);
+                masks++;
+                break;
+            case OP_JUMP:
+                emit_vec(vec, VEC_ELSE, 0);
+                break;
+            case OP_ERROR:
+                emit_vec(vec, VEC_ERROR, instr -> arg);
+                break;
+            case OP_HALT:
+                emit_vec(vec, VEC_HALT, 0);
+                break;
+        }
+        if (depth > vec -> max_depth) {
+            vec -> max_depth = depth;
+        }
+        if (masks > vec -> max_masks) {
+            vec -> max_masks = masks;
+        }
+    }
+    tracked_free(ends);
+    return 0;
+}
+
+/// Runs a column program over one batch of rows
+///
+/// @param vec The program
+/// @param kernels The batch operations to use
+/// @param cols The columns
+/// @param row The first row of the batch
+/// @param n The number of rows in the batch
+/// @param buffers The memory of each stack slot (COLUMN_BATCH each)
+/// @param stack The values of each stack slot, a column or a buffer
+/// @param masks The mask stack (COLUMN_BATCH each), the first all set
+/// @param errors Set to the error of each row
+/// @return Returns the results of the rows
+static const int *run_columns(vec_program_t *vec, const kernels_t *kernels,
+                              columns_t *cols, long row, int n, int *buffers,
+                              const int **stack, int *masks, int *errors) {
+    int sp = 0, mp = 0;     // the next free slot and the current mask
+
+    memset(errors, 0, n * sizeof(int));
+
+    for (int pc = 0; ; pc++) {
+        vec_instr_t *instr = &vec -> code[pc];
+        int *mask = masks + (long)mp * COLUMN_BATCH;
+        int *dst;
+
+        switch (instr -> op) {
+            case VEC_CONST:
+                dst = buffers + (long)sp * COLUMN_BATCH;
+                for (int i = 0; i < n; i++) {
+                    dst[i] = instr -> arg;
+                }
+                stack[sp++] = dst;
+                break;
+            case VEC_COLUMN:
+                // Columns are read in place, nothing is copied
+                stack[sp++] = cols -> columns[instr -> arg].values + row;
+                break;
+            case VEC_ADD:
+            case VEC_SUB:
+            case VEC_MUL:
+                sp--;
+                dst = buffers + (long)(sp - 1) * COLUMN_BATCH;
+                (instr -> op == VEC_ADD ? kernels -> add
+                    : instr -> op == VEC_SUB ? kernels -> sub
+                    : kernels -> mul)(dst, stack[sp - 1], stack[sp], n);
+                stack[sp - 1] = dst;
+                break;
+            case VEC_DIV:
+            case VEC_MOD:
+                // The left side is on top for these
+                sp--;
+                dst = buffers + (long)(sp - 1) * COLUMN_BATCH;
+                divide(dst, stack[sp], stack[sp - 1], mask, errors,
+                       instr -> op == VEC_MOD, n);
+                stack[sp - 1] = dst;
+                break;
+            case VEC_ERROR:
+                for (int i = 0; i < n; i++) {
+                    if (mask[i]) {
+                        errors[i] = instr -> arg;
+                    }
+                }
+                break;
+            case VEC_BRANCH:
+                kernels -> nonzero(mask + COLUMN_BATCH, mask, stack[sp - 1], n);
+                mp++;
+                break;
+            case VEC_ELSE:
+                kernels -> zero(mask, mask - COLUMN_BATCH, stack[sp - 2], n);
+                break;
+            case VEC_SELECT:
+                sp -= 2;
+                dst = buffers + (long)(sp - 1) * COLUMN_BATCH;
+                kernels -> select(dst, stack[sp - 1], stack[sp], stack[sp + 1], n);
+                stack[sp - 1] = dst;
+                mp--;
+                break;
+            case VEC_HALT:
+                return stack[sp - 1];
+        }
+    }
+}
+
+void eval_columns(char *filename, char *exp) {
+    columns_t cols;
+    program_t prog;
+    vec_program_t vec;
+
+    load_columns(&cols, filename);
+
+    // The expression is parsed and compiled just as rep does it
+    long long start = start_timer();
+    tree_node_t *tree = make_parse_tree(exp);
+    stop_timer(TIME_PARSE, start);
+    if (default_context.parse_error != PARSE_NONE) {
+        report_parse_error(default_context.parse_error);
+        exit(EXIT_FAILURE);
+    }
+
+    start = start_timer();
+    init_program(&prog);
+    if (compile_tree(&prog, optimize_tree(&default_context.arena, tree)) < 0) {
+        fprintf(stderr, "Could not allocate memory for the program\n");
+        exit(EXIT_FAILURE);
+    }
+    if (compile_columns(&vec, &prog, &cols) < 0) {
+        fprintf(stderr, "Assignments can't be evaluated over columns\n");
+        exit(EXIT_FAILURE);
+    }
+    stop_timer(TIME_COMPILE, start);
+    free_program(&prog);
+    cleanup_tree(tree);
+
+    const kernels_t *kernels = choose_kernels();
+    int *buffers = (int *)tracked_malloc((long)vec.max_depth * COLUMN_BATCH * sizeof(int));
+    int *masks = (int *)tracked_malloc((long)vec.max_masks * COLUMN_BATCH * sizeof(int));
+    int *errors = (int *)tracked_malloc(COLUMN_BATCH * sizeof(int));
+    const int **stack = (const int **)tracked_malloc(vec.max_depth * sizeof(int *));
+    if (buffers == NULL || masks == NULL || errors == NULL || stack == NULL) {
+        fprintf(stderr, "Could not allocate memory for the batches\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Every row of a batch is evaluated to start with
+    for (int i = 0; i < COLUMN_BATCH; i++) {
+        masks[i] = -1;
+    }
+
+    output_t *out = standard_output();
+    output_str(out, "result\n");
+    for (long row = 0; row < cols.rows; row += COLUMN_BATCH) {
+        int n = cols.rows - row < COLUMN_BATCH ? (int)(cols.rows - row) : COLUMN_BATCH;
+
+        start = start_timer();
+        const int *results = run_columns(&vec, kernels, &cols, row, n, buffers,
+                                         stack, masks, errors);
+        stop_timer(TIME_EVAL, start);
+        STAT_ADD(expressions, n);
+
+        start = start_timer();
+        for (int i = 0; i < n; i++) {
+            if (errors[i] != EVAL_NONE) {
+                output_bytes(out, "\n", 1);
+                fprintf(stderr, "Row %ld: ", row + i + 1);
+                report_eval_error((eval_error_t)errors[i]);
+            }
+            else {
+                output_int(out, results[i]);
+                output_bytes(out, "\n", 1);
+            }
+        }
+        stop_timer(TIME_PRINT, start);
+    }
+
+    if (stats_on) {
+        fprintf(stderr, "Columns: %ld rows with the %s kernels\n", cols.rows, kernels -> name);
+    }
+    tracked_free(stack);
+    tracked_free(errors);
+    tracked_free(masks);
+    tracked_free(buffers);
+    tracked_free(vec.code);
+    free_columns(&cols);
+}
@@ -0,0 +1,28 @@
+// Evaluation of one expression over whole columns of symbol values
+
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#define COLUMN_BATCH 1024       // rows evaluated together by each instruction
+
+/// Evaluates an expression once for every row of a CSV file.  The
+/// first line of the file names the columns, each column gives the
+/// values of the symbol of that name, and every other line is a row
+/// of integers.  Symbols that aren't columns come from the symbol
+/// table.  The expression is compiled once and run over batches of
+/// COLUMN_BATCH rows at a time, using SIMD instructions where the
+/// processor has them.  The results and errors of each row are
+/// exactly those rep would give with the row's values in the table.
+///
+/// Standard output gets a column named result, with the value of each
+/// row on its own line.  A row with an eval error gets an empty line,
+/// and the error is displayed to standard error with the row number.
+/// @param filename The CSV file of columns
+/// @param exp The postfix expression to evaluate
+/// @exception If the file can't be read or has a malformed row, the
+///     expression doesn't parse, or it assigns to a symbol, an error
+///     message is displayed to standard error and the program exits
+///     with EXIT_FAILURE
+void eval_columns(char *filename, char *exp);
+
+#endif
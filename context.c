@@ -0,0 +1,33 @@
+#include <string.h>
+#include "context.h"
+
+// All zeros is a valid context, with the standard streams
+context_t default_context;
+
+void init_context(context_t *ctx, output_t *out, FILE *err) {
+    memset(&ctx -> symtab, 0, sizeof(ctx -> symtab));
+    arena_init(&ctx -> symtab.pool);
+    ctx -> parse_error = PARSE_NONE;
+    ctx -> eval_error = EVAL_NONE;
+    arena_init(&ctx -> arena);
+    init_program(&ctx -> program);
+    init_vm(&ctx -> vm);
+    ctx -> out = out;
+    ctx -> err = err;
+    ctx -> reader = NULL;
+}
+
+void free_context(context_t *ctx) {
+    ctx_free_table(ctx);
+    arena_free(&ctx -> arena);
+    free_program(&ctx -> program);
+    free_vm(&ctx -> vm);
+}
+
+output_t *context_out(context_t *ctx) {
+    return ctx -> out ? ctx -> out : standard_output();
+}
+
+FILE *context_err(context_t *ctx) {
+    return ctx -> err ? ctx -> err : stderr;
+}
@@ -0,0 +1,183 @@
+// Interpreter contexts, so several interpreters can run in one process
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stdio.h>
+#include "arena.h"
+#include "bytecode.h"
+#include "output.h"
+#include "parser.h"
+#include "symtab.h"
+
+/// Everything one interpreter changes as it runs.  Contexts share
+/// nothing but the --stats counters, which are atomic, and the tables
+/// shared with ctx_share_table, so threads with a context each can run
+/// fully in parallel.
+typedef struct context_s {
+    symtab_t symtab;            ///< the symbols
+    parse_error_t parse_error;  ///< the error from the last parse, or PARSE_NONE
+    eval_error_t eval_error;    ///< the error from the last evaluation, or EVAL_NONE
+    arena_t arena;              ///< the trees and tokens of the current line
+    program_t program;          ///< the current line compiled
+    vm_t vm;                    ///< the machine lines are run on (and ctx_eval_tree's values)
+    output_t *out;              ///< where results go (NULL for standard output)
+    FILE *err;                  ///< where errors go (NULL for standard error)
+    struct reader_s *reader;    ///< set while the symbols are a shared table (see ctx_share_table)
+} context_t;
+
+/// The context behind rep, build_table, lookup_table and the rest of
+/// the functions that don't take one.  It is the only context the
+/// cache, the machine code and the reactive formulas work with.
+extern context_t default_context;
+
+/// Initializes a context with an empty symbol table
+/// @param ctx The context to initialize
+/// @param out Where results go (NULL for standard output)
+/// @param err Where errors go (NULL for standard error)
+void init_context(context_t *ctx, output_t *out, FILE *err);
+
+/// Frees the symbol table and everything else the context allocated,
+/// but doesn't flush its output or close its streams
+/// @param ctx The context to free
+void free_context(context_t *ctx);
+
+/// The output results go to
+/// @param ctx The context
+/// @return out, or standard_output() if it is NULL
+output_t *context_out(context_t *ctx);
+
+/// The stream errors go to
+/// @param ctx The context
+/// @return err, or stderr if it is NULL
+FILE *context_err(context_t *ctx);
+
+/// rep, in a context
+/// @param ctx The context
+/// @param exp The expression as a string
+void ctx_rep(context_t *ctx, char *exp);
+
+/// make_parse_tree, with the tree in the context's arena and the error
+/// in its parse_error
+/// @param ctx The context
+/// @param expr The postfix expression as a C string
+/// @return the root of the expression tree
+tree_node_t *ctx_make_parse_tree(context_t *ctx, char *expr);
+
+/// eval_tree, with the context's symbols and eval_error
+/// @param ctx The context
+/// @param node The node in the tree
+/// @return the evaluated int
+int ctx_eval_tree(context_t *ctx, tree_node_t *node);
+
+/// cleanup_tree, for a tree from ctx_make_parse_tree
+/// @param ctx The context
+/// @param node The root of the tree (may be NULL)
+void ctx_cleanup_tree(context_t *ctx, tree_node_t *node);
+
+/// run_program, with the context's symbols
+/// @param ctx The context
+/// @param vm The machine to run the program on
+/// @param prog The program to run
+/// @param error Set to the eval error, or EVAL_NONE
+/// @return the value of the expression
+int ctx_run_program(context_t *ctx, vm_t *vm, program_t *prog, eval_error_t *error);
+
+/// build_table, into the context's symbols
+/// @param ctx The context
+/// @param filename The name of the file containing the symbols
+void ctx_build_table(context_t *ctx, char *filename);
+
+/// dump_table, to the context's output
+/// @param ctx The context
+void ctx_dump_table(context_t *ctx);
+
+/// lookup_table, in the context's symbols
+/// @param ctx The context
+/// @param variable The name of the variable
+/// @return The symbol, or NULL if not found
+symbol_t *ctx_lookup_table(context_t *ctx, char *variable);
+
+/// create_symbol, in the context's symbols
+/// @param ctx The context
+/// @param name The name of the symbol
+/// @param val The initial value bound to the symbol
+/// @return The new symbol, or NULL if it could not be allocated
+symbol_t *ctx_create_symbol(context_t *ctx, char *name, int val);
+
+/// table_version, of the context's symbols
+/// @param ctx The context
+/// @return the version of the table
+unsigned long ctx_table_version(context_t *ctx);
+
+/// save_table, from the context's symbols
+/// @param ctx The context
+/// @param filename The file to write
+void ctx_save_table(context_t *ctx, char *filename);
+
+/// load_table, into the context's symbols
+/// @param ctx The context
+/// @param filename The snapshot to load
+void ctx_load_table(context_t *ctx, char *filename);
+
+/// free_table, for the context's symbols.  A context that joined
+/// another's shared table just leaves it.
+/// @param ctx The context
+void ctx_free_table(context_t *ctx);
+
+/// Makes the context's symbol table one that other contexts can join
+/// and use from their own threads.  Lookups in a shared table take no
+/// locks.  Writers take turns, publishing each new value and symbol
+/// with atomic stores, and a name is only ever added once: creating a
+/// symbol another thread already added just assigns it.  Memory a
+/// reader may still be looking at (old indexes and replaced values)
+/// is freed only once every reader has moved past the epoch it was
+/// retired in.  The table should be built or loaded first; build_table,
+/// load_table and save_table aren't safe on it once it is shared.  The
+/// default context's table can't be shared, as the cache, the machine
+/// code and the reactive formulas use its symbols directly.
+/// @param ctx The context
+/// @exception If the memory can't be allocated, or ctx is the default
+///     context, an error message is displayed to standard error and the
+///     program exits with EXIT_FAILURE
+void ctx_share_table(context_t *ctx);
+
+/// Makes a context use another's shared table instead of its own
+/// symbols, until it is freed.  The owner has to be freed after every
+/// context that joined it.
+/// @param ctx The context joining
+/// @param owner The context that shared its table
+/// @exception If owner's table isn't shared or the memory can't be
+///     allocated, an error message is displayed to standard error and
+///     the program exits with EXIT_FAILURE
+void ctx_join_table(context_t *ctx, context_t *owner);
+
+/// Pins the values of a shared table for a batch of lines: until
+/// ctx_unpin_table, the context sees the symbols and values as they
+/// were after one write, whatever other threads write meanwhile.  Its
+/// own writes are published as usual but aren't seen until it unpins.
+/// Nothing retired while a reader is pinned is freed, so batches
+/// should be kept short.  Does nothing if the table isn't shared.
+/// @param ctx The context
+void ctx_pin_table(context_t *ctx);
+
+/// Ends what ctx_pin_table started, so the context sees the newest
+/// values again
+/// @param ctx The context
+void ctx_unpin_table(context_t *ctx);
+
+/// The value of a symbol, as a context using a shared table sees it
+/// @param ctx The context, with a shared table
+/// @param symbol A symbol of the table
+/// @return The newest value, or the one pinned by ctx_pin_table
+int ctx_shared_value(context_t *ctx, symbol_t *symbol);
+
+/// Binds a value to a symbol of a shared table, as a writer
+/// @param ctx The context, with a shared table
+/// @param symbol A symbol of the table
+/// @param val The value
+/// @exception If the memory can't be allocated, an error message is
+///     displayed to standard error and the program exits with EXIT_FAILURE
+void ctx_shared_assign(context_t *ctx, symbol_t *symbol, int val);
+
+#endif
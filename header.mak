@@ -1 +1,2 @@
 CFLAGS = -std=c99 -ggdb -Wall -Wextra -pedantic
+CLIBFLAGS = -pthread
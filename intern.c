@@ -0,0 +1,171 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intern.h"
+#include "arena.h"
+#include "alloc.h"
+
+#define MIN_INTERNED 1024       // slots in the first index
+
+/// A string in the pool
+typedef struct interned_s {
+    unsigned int hash;          ///< the hash of text
+    char text[];                ///< the string itself
+} interned_t;
+
+/// An open-addressing index of the pool.  Threads may still be probing
+/// an index after it has been outgrown, so the old ones are kept until
+/// free_interned; each is half the size of the next, so together they
+/// are never bigger than the newest.
+typedef struct pool_index_s {
+    size_t mask;                ///< the number of slots, less one
+    struct pool_index_s *older; ///< the index this one replaced
+    interned_t *slots[];        ///< the strings, at most half full
+} pool_index_t;
+
+static pool_index_t *pool;      // the newest index, read without the lock
+static size_t num_interned;
+static arena_t strings;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// Hashes a string the way hash_name does
+///
+/// @param text The characters
+/// @param len The number of characters
+/// @return the hash
+static unsigned int hash_text(const char *text, size_t len) {
+    unsigned int hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/// Looks for a string in an index
+///
+/// @param index The index
+/// @param text The characters
+/// @param len The number of characters
+/// @param hash The hash of the characters
+/// @return Returns the string in the pool, or NULL if it isn't there
+static interned_t *find_interned(pool_index_t *index, const char *text, size_t len,
+                                 unsigned int hash) {
+    size_t i = hash & index -> mask;
+    interned_t *entry;
+
+    while ((entry = __atomic_load_n(&index -> slots[i], __ATOMIC_ACQUIRE)) != NULL) {
+        if (entry -> hash == hash && !strncmp(entry -> text, text, len) &&
+            entry -> text[len] == '\0') {
+            return entry;
+        }
+        i = (i + 1) & index -> mask;
+    }
+    return NULL;
+}
+
+/// Puts a string in the first free slot for it.  Until the index is
+/// published the store needn't be atomic, but it does no harm.
+///
+/// @param index The index
+/// @param entry The string
+static void place_interned(pool_index_t *index, interned_t *entry) {
+    size_t i = entry -> hash & index -> mask;
+
+    while (index -> slots[i]) {
+        i = (i + 1) & index -> mask;
+    }
+    __atomic_store_n(&index -> slots[i], entry, __ATOMIC_RELEASE);
+}
+
+/// Grows the index until it can hold count strings at a load factor of
+/// one half, keeping the old one for threads still probing it.  Called
+/// with the lock held.
+///
+/// @param count The number of strings to make room for
+/// @return Returns the new index, or NULL if it could not be allocated
+static pool_index_t *grow_pool(size_t count) {
+    size_t size = pool ? (pool -> mask + 1) * 2 : MIN_INTERNED;
+    while (count * 2 > size) {
+        size *= 2;
+    }
+    pool_index_t *index = (pool_index_t *)tracked_calloc(1, sizeof(pool_index_t) + size * sizeof(interned_t *));
+
+    if (index == NULL) {
+        return NULL;
+    }
+    index -> mask = size - 1;
+    index -> older = pool;
+    if (pool) {
+        for (size_t i = 0; i <= pool -> mask; i++) {
+            if (pool -> slots[i]) {
+                place_interned(index, pool -> slots[i]);
+            }
+        }
+    }
+    __atomic_store_n(&pool, index, __ATOMIC_RELEASE);
+    return index;
+}
+
+char *intern(const char *text, size_t len) {
+    unsigned int hash = hash_text(text, len);
+    pool_index_t *index = __atomic_load_n(&pool, __ATOMIC_ACQUIRE);
+    interned_t *entry = index ? find_interned(index, text, len, hash) : NULL;
+
+    if (entry) {
+        return entry -> text;
+    }
+
+    // Look again with the lock held, another thread may have just added it
+    pthread_mutex_lock(&lock);
+    index = pool;
+    entry = index ? find_interned(index, text, len, hash) : NULL;
+    if (entry == NULL && (num_interned + 1) * 2 > (index ? index -> mask + 1 : 0)) {
+        index = grow_pool(num_interned + 1);
+    }
+    if (entry == NULL && index) {
+        entry = (interned_t *)arena_alloc(&strings, sizeof(interned_t) + len + 1);
+        if (entry) {
+            entry -> hash = hash;
+            memcpy(entry -> text, text, len);
+            entry -> text[len] = '\0';
+            place_interned(index, entry);
+            num_interned++;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return entry ? entry -> text : NULL;
+}
+
+char *lookup_interned(const char *text, size_t len) {
+    pool_index_t *index = __atomic_load_n(&pool, __ATOMIC_ACQUIRE);
+    interned_t *entry = index ? find_interned(index, text, len, hash_text(text, len)) : NULL;
+
+    return entry ? entry -> text : NULL;
+}
+
+unsigned int interned_hash(const char *interned) {
+    return ((const interned_t *)(interned - offsetof(interned_t, text))) -> hash;
+}
+
+void reserve_interned(size_t count) {
+    pthread_mutex_lock(&lock);
+    if ((num_interned + count) * 2 > (pool ? pool -> mask + 1 : 0)) {
+        grow_pool(num_interned + count);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void free_interned(void) {
+    while (pool) {
+        pool_index_t *older = pool -> older;
+        tracked_free(pool);
+        pool = older;
+    }
+    arena_free(&strings);
+    num_interned = 0;
+}
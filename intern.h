@@ -0,0 +1,40 @@
+// One shared copy of every symbol name, for all contexts and threads
+
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+
+/// Finds the one copy of a string kept in the pool, adding it the first
+/// time it is seen, so the same text is always the same pointer.
+/// Interned strings are never moved or freed before free_interned, so
+/// they outlive the lines, programs and tables that use them.  Finding
+/// a string that is already there takes no locks; adding one does.
+/// @param text The characters (need not be null terminated)
+/// @param len The number of characters
+/// @return the interned string, which must not be modified, or NULL
+///     if it could not be allocated
+char *intern(const char *text, size_t len);
+
+/// Finds the copy of a string kept in the pool without adding it, for
+/// text that may only be needed for a moment.  Takes no locks.
+/// @param text The characters (need not be null terminated)
+/// @param len The number of characters
+/// @return the interned string, or NULL if it was never interned
+char *lookup_interned(const char *text, size_t len);
+
+/// The hash of an interned string, which is the one hash_name gives
+/// @param interned A string returned by intern
+/// @return the hash
+unsigned int interned_hash(const char *interned);
+
+/// Makes room for count more strings, so adding a known number of
+/// them doesn't grow the pool's index over and over
+/// @param count The number of strings about to be interned
+void reserve_interned(size_t count);
+
+/// Frees every interned string.  Nothing holding one (trees, programs,
+/// symbol tables, the cache) may be used afterwards.
+void free_interned(void);
+
+#endif
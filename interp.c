@@ -3,45 +3,318 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "parser.h"
+#include "alloc.h"
 #include "interp.h"
+#include "context.h"
 #include "symtab.h"
+#include "intern.h"
+#include "batch.h"
+#include "parallel.h"
+#include "cache.h"
+#include "stats.h"
+#include "columnar.h"
+#include "jit.h"
+#include "output.h"
+#include "reactive.h"
+#include "script.h"
+#include "server.h"
+
+/// Displays how to run the program and exits
+static void usage(void) {
+    fprintf(stderr, "Usage: interp [-f sym-table | --load-table snapshot] [--save-table snapshot]\n              [--stats] [-c cache-size [--jit]] [-b expr-file [-j threads]]\n              [--reactive] [--jit-check count] [--columns csv-file expression]\n              [--output text|values|compact] [--compile script -o compiled]\n              [--run compiled] [--serve socket] [--alloc-stats]\n              [--alloc-check count] [sym-table]\n");
+    exit(EXIT_FAILURE);
+}
+
+/// Displays the final symbol table and how the cache did, then
+/// frees everything
+static void finish(void) {
+    output_t *out = standard_output();
+
+    // Only the text output has anything but the results
+    if (out -> mode == OUTPUT_TEXT) {
+        dump_table();
+    }
+    free_output(out);
+
+    if (cache_enabled()) {
+        cache_stats_t stats;
+        get_cache_stats(&stats);
+        fprintf(stderr, "Cache: %ld hits, %ld misses, %ld evictions, %d of %d entries\n",
+                stats.hits, stats.misses, stats.evictions, stats.entries, stats.capacity);
+        free_cache();
+    }
+    if (reactive_enabled()) {
+        free_reactive();
+    }
+    if (stats_on) {
+        print_stats(stderr);
+    }
+    free_context(&default_context);
+    free_interned();
+    if (alloc_tracking) {
+        print_alloc_stats(stderr);
+    }
+}
 
 int main(int argc, char **argv) {
-    char *filename;
-    if (argc == 2){
-        filename = argv[1];
-    } 
-    else if (argc == 1){
-        filename = NULL;
+    char *filename = NULL, *batch_file = NULL;
+    char *column_file = NULL, *column_exp = NULL;
+    char *load_file = NULL, *save_file = NULL;
+    char *script_file = NULL, *compiled_file = NULL, *run_file = NULL;
+    char *socket_path = NULL;
+    long jit_checks = 0, alloc_checks = 0;
+    int alloc_stats = 0;
+    int threads = 1, cache_size = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            filename = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            batch_file = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--load-table") && i + 1 < argc) {
+            load_file = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--save-table") && i + 1 < argc) {
+            save_file = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--compile") && i + 1 < argc) {
+            script_file = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            compiled_file = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--run") && i + 1 < argc) {
+            run_file = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--serve") && i + 1 < argc) {
+            socket_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--jit")) {
+            enable_jit();
+        }
+        else if (!strcmp(argv[i], "--jit-check") && i + 1 < argc) {
+            jit_checks = atol(argv[++i]);
+            if (jit_checks < 1) {
+                usage();
+            }
+        }
+        else if (!strcmp(argv[i], "--alloc-stats")) {
+            alloc_stats = 1;
+        }
+        else if (!strcmp(argv[i], "--alloc-check") && i + 1 < argc) {
+            alloc_checks = atol(argv[++i]);
+            if (alloc_checks < 1) {
+                usage();
+            }
+        }
+        else if (!strcmp(argv[i], "--columns") && i + 2 < argc) {
+            column_file = argv[++i];
+            column_exp = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--output") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "text")) {
+                standard_output() -> mode = OUTPUT_TEXT;
+            }
+            else if (!strcmp(argv[i], "values")) {
+                standard_output() -> mode = OUTPUT_VALUES;
+            }
+            else if (!strcmp(argv[i], "compact")) {
+                standard_output() -> mode = OUTPUT_COMPACT;
+            }
+            else {
+                usage();
+            }
+        }
+        else if (!strcmp(argv[i], "--reactive")) {
+            enable_reactive();
+        }
+        else if (!strcmp(argv[i], "--stats")) {
+            start_stats();
+        }
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+            cache_size = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads < 1) {
+                usage();
+            }
+        }
+        else if (argv[i][0] != '-' && filename == NULL) {
+            filename = argv[i];
+        }
+        else {
+            usage();
+        }
+    }
+
+    if (filename && load_file) {
+        usage();
+    }
+
+    // Only memory allocated while counting can be counted when freed,
+    // so this comes before anything is allocated
+    if (alloc_stats || alloc_checks) {
+        start_alloc_tracking(alloc_stats);
+    }
+    init_cache(cache_size);
+    if ((script_file == NULL) != (compiled_file == NULL)) {
+        usage();
     }
-    else {
-        fprintf(stderr, "Usage: interp [sym-table]\n");
-        exit(EXIT_FAILURE);
+
+    // A compiled script is run on its own, one line after another
+    if (run_file && (batch_file || column_file || cache_enabled() || threads > 1 ||
+                     reactive_enabled())) {
+        usage();
+    }
+
+    // and so is the server, which evaluates its clients' lines in order
+    if (socket_path && (run_file || batch_file || column_file || threads > 1)) {
+        usage();
     }
 
+    // Formulas are recorded as each line is evaluated in order, which
+    // neither the cache nor the thread pool does
+    if (reactive_enabled() && (cache_enabled() || threads > 1)) {
+        usage();
+    }
     if (filename) {
         build_table(filename);
     }
-    dump_table();
+    if (load_file) {
+        load_table(load_file);
+    }
+
+    // Saving a snapshot is all that is done when one is asked for
+    if (save_file) {
+        save_table(save_file);
+        free_table();
+        free_interned();
+        return 0;
+    }
+
+    // and the same for compiling a script, which needs no symbols
+    if (script_file) {
+        compile_script(script_file, compiled_file);
+        free_table();
+        free_interned();
+        return 0;
+    }
+
+    // Compare the machine code against eval_tree on random expressions
+    if (jit_checks) {
+        long mismatches = check_jit(jit_checks);
+        if (mismatches < 0) {
+            fprintf(stderr, "The JIT is only built for x86-64\n");
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "JIT check: %ld expressions, %ld mismatches\n", jit_checks, mismatches);
+        free_table();
+        free_interned();
+        return mismatches ? EXIT_FAILURE : 0;
+    }
 
-    printf("Enter postfix expressions (CTRL-D to exit):\n");
+    // Run the same lines twice, and check the second run left nothing
+    if (alloc_checks) {
+        alloc_stats_t warm, after;
+        long long growth = check_allocations(alloc_checks, &warm, &after);
+        fprintf(stderr, "Alloc check: %ld lines, %lld objects (%lld bytes) live after the warm-up, "
+                "%lld (%lld bytes) after\n", alloc_checks, warm.live, warm.live_bytes,
+                after.live, after.live_bytes);
+        free_table();
+        free_interned();
+        return growth ? EXIT_FAILURE : 0;
+    }
+
+    // Columnar mode only prints the result column, not the table
+    if (column_file) {
+        buffer_output();
+        eval_columns(column_file, column_exp);
+        free_output(standard_output());
+        if (stats_on) {
+            print_stats(stderr);
+        }
+        free_table();
+        free_interned();
+        return 0;
+    }
+
+    // A compiled script prints what batch mode would for its lines
+    if (run_file) {
+        buffer_output();
+        if (standard_output() -> mode == OUTPUT_TEXT) {
+            dump_table();
+        }
+        run_script(run_file);
+        finish();
+        return 0;
+    }
+
+    // The server runs until it is stopped, with no prompts
+    if (socket_path) {
+        buffer_output();
+        if (standard_output() -> mode == OUTPUT_TEXT) {
+            dump_table();
+        }
+        serve(socket_path);
+        finish();
+        return 0;
+    }
+
+    // Batch mode has no prompts, "-" reads the expressions from stdin
+    if (batch_file) {
+        FILE *fp = strcmp(batch_file, "-") ? fopen(batch_file, "r") : stdin;
+        if (fp == NULL) {
+            perror(batch_file);
+            exit(EXIT_FAILURE);
+        }
+        buffer_output();
+        if (standard_output() -> mode == OUTPUT_TEXT) {
+            dump_table();
+        }
+        if (threads > 1) {
+            start_workers(threads);
+        }
+        run_batch(fp, threads);
+        if (threads > 1) {
+            stop_workers();
+        }
+        if (fp != stdin) {
+            fclose(fp);
+        }
+        finish();
+        return 0;
+    }
+
+    // Values and compact output are only the results, with no prompts
+    output_t *out = standard_output();
+    const char *prompt = out -> mode == OUTPUT_TEXT ? "> " : "";
+    if (out -> mode == OUTPUT_TEXT) {
+        dump_table();
+        output_str(out, "Enter postfix expressions (CTRL-D to exit):\n");
+    }
     
     int cur_pos = 0;
-    char c, exp[MAX_LINE];
+    char c, exp[MAX_LINE + 1];
 
     for (int i = 0; i <= MAX_LINE; i++) {
         exp[i] = '\0';
     }
 
-    printf("> ");
+    output_str(out, prompt);
     while((c = getchar()) != EOF && cur_pos < MAX_LINE) {
         if (c == '\n'){
             rep(exp);
+            poll_stats(stderr);
             for (int i = 0; i <= cur_pos; i++) {
                 exp[i] = '\0';
             }
-            printf("> ");
+            output_str(out, prompt);
             cur_pos = 0;
         }
         else {
@@ -49,8 +322,7 @@ int main(int argc, char **argv) {
             cur_pos++;
         }
     }
-    printf("\n");
-    dump_table();
-    free_table();
+    output_str(out, out -> mode == OUTPUT_TEXT ? "\n" : "");
+    finish();
     return 0;
 }
@@ -0,0 +1,562 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "jit.h"
+#include "alloc.h"
+#include "parser.h"
+#include "context.h"
+#include "optimize.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static int jit_on;
+
+void enable_jit(void) {
+    jit_on = 1;
+}
+
+int jit_enabled(void) {
+#ifdef HAVE_JIT
+    return jit_on;
+#else
+    return 0;
+#endif
+}
+
+void init_jit(jit_code_t *jit) {
+    jit -> code = NULL;
+    jit -> size = 0;
+    jit -> symbols = NULL;
+    jit -> length = 0;
+    jit -> max_depth = 0;
+    jit -> version = 0;
+}
+
+void free_jit(jit_code_t *jit) {
+#ifdef HAVE_JIT
+    if (jit -> code) {
+        munmap(jit -> code, jit -> size);
+    }
+#endif
+    tracked_free(jit -> symbols);
+    init_jit(jit);
+}
+
+#ifdef HAVE_JIT
+
+#define MAX_INSTR_BYTES 64      // the most machine code one instruction becomes
+#define PROLOGUE_BYTES 32       // the entry and exit code
+
+/// Machine code being written
+typedef struct emitter_s {
+    unsigned char *code;        ///< the start of the pages
+    size_t length;              ///< bytes written so far
+} emitter_t;
+
+// The registers the code keeps its state in
+#define EAX 0
+#define ECX 1
+#define EDX 2
+
+/// Called by the machine code to load a symbol it hasn't found yet
+///
+/// @param sym The symbol to look for, bound if found
+/// @param error Set to UNDEFINED_SYMBOL if it isn't found
+/// @return Returns the value, or -1 if the symbol isn't found
+static int load_symbol(jit_symbol_t *sym, int *error) {
+    sym -> symbol = lookup_table(sym -> name);
+    if (sym -> symbol == NULL) {
+        *error = UNDEFINED_SYMBOL;
+        return -1;
+    }
+    return sym -> symbol -> val;
+}
+
+/// Called by the machine code to store to a symbol it hasn't found
+/// yet, creating the symbol if needed
+///
+/// @param sym The symbol to store to, bound once found or made
+/// @param value The value to bind
+/// @param error Set to SYMTAB_FULL if the symbol could not be made
+static void store_symbol(jit_symbol_t *sym, int value, int *error) {
+    sym -> symbol = lookup_table(sym -> name);
+    if (sym -> symbol) {
+        sym -> symbol -> val = value;
+        return;
+    }
+    sym -> symbol = create_symbol(sym -> name, value);
+    if (sym -> symbol == NULL) {
+        *error = SYMTAB_FULL;
+    }
+}
+
+static void emit_byte(emitter_t *e, int byte) {
+    e -> code[e -> length++] = (unsigned char)byte;
+}
+
+static void emit_bytes(emitter_t *e, const char *bytes, int count) {
+    memcpy(e -> code + e -> length, bytes, count);
+    e -> length += count;
+}
+
+static void emit_int(emitter_t *e, int value) {
+    memcpy(e -> code + e -> length, &value, sizeof(int));
+    e -> length += sizeof(int);
+}
+
+static void emit_pointer(emitter_t *e, const void *pointer) {
+    uint64_t value = (uint64_t)(uintptr_t)pointer;
+    memcpy(e -> code + e -> length, &value, sizeof(value));
+    e -> length += sizeof(value);
+}
+
+/// Emits an instruction on a value stack slot, which is addressed
+/// as [r12 + 4 * slot]
+///
+/// @param e The code being written
+/// @param opcode The opcode bytes
+/// @param count The number of opcode bytes
+/// @param reg The register (or opcode extension) in the ModRM byte
+/// @param slot The slot of the value stack
+static void emit_slot(emitter_t *e, const char *opcode, int count, int reg, int slot) {
+    emit_byte(e, 0x41);                 // REX.B for r12
+    emit_bytes(e, opcode, count);
+    emit_byte(e, 0x84 | reg << 3);      // [base + disp32] with a SIB byte
+    emit_byte(e, 0x24);                 // base r12, no index
+    emit_int(e, slot * (int)sizeof(int));
+}
+
+/// Emits mov dword [r12 + 4 * slot], value
+static void emit_store_constant(emitter_t *e, int slot, int value) {
+    emit_slot(e, "\xc7", 1, 0, slot);
+    emit_int(e, value);
+}
+
+/// Emits mov dword [rbx], error, rbx holding the address of the error
+static void emit_error(emitter_t *e, int error) {
+    emit_bytes(e, "\xc7\x03", 2);
+    emit_int(e, error);
+}
+
+/// Emits a short conditional or unconditional jump to be patched later
+///
+/// @param e The code being written
+/// @param opcode 0x74 for jz, 0x75 for jnz, 0xeb for jmp
+/// @return Returns where the offset goes
+static size_t emit_short_jump(emitter_t *e, int opcode) {
+    emit_byte(e, opcode);
+    emit_byte(e, 0);
+    return e -> length - 1;
+}
+
+/// Points a short jump at the end of the code written so far
+static void patch_short_jump(emitter_t *e, size_t at) {
+    e -> code[at] = (unsigned char)(e -> length - (at + 1));
+}
+
+/// Emits the code to call a helper, the arguments already in place
+static void emit_call(emitter_t *e, const void *function) {
+    emit_bytes(e, "\x48\xb8", 2);       // mov rax, function
+    emit_pointer(e, function);
+    emit_bytes(e, "\xff\xd0", 2);       // call rax
+}
+
+/// Emits the code for OP_LOAD.  A bound symbol is read directly,
+/// otherwise load_symbol looks for it.
+///
+/// @param e The code being written
+/// @param sym The symbol to load
+/// @param slot Where to put the value
+static void emit_load(emitter_t *e, jit_symbol_t *sym, int slot) {
+    emit_bytes(e, "\x48\xb8", 2);       // mov rax, sym
+    emit_pointer(e, sym);
+    emit_bytes(e, "\x48\x8b\x48", 3);   // mov rcx, [rax + symbol]
+    emit_byte(e, offsetof(jit_symbol_t, symbol));
+    emit_bytes(e, "\x48\x85\xc9", 3);   // test rcx, rcx
+    size_t to_lookup = emit_short_jump(e, 0x74);
+    emit_bytes(e, "\x8b\x49", 2);       // mov ecx, [rcx + val]
+    emit_byte(e, offsetof(symbol_t, val));
+    size_t to_done = emit_short_jump(e, 0xeb);
+
+    patch_short_jump(e, to_lookup);
+    emit_bytes(e, "\x48\x89\xc7", 3);   // mov rdi, rax
+    emit_bytes(e, "\x48\x89\xde", 3);   // mov rsi, rbx
+    emit_call(e, (const void *)(uintptr_t)load_symbol);
+    emit_bytes(e, "\x89\xc1", 2);       // mov ecx, eax
+
+    patch_short_jump(e, to_done);
+    emit_slot(e, "\x89", 1, ECX, slot);
+}
+
+/// Emits the code for OP_STORE.  A bound symbol is written directly,
+/// otherwise store_symbol looks for it or makes it.
+///
+/// @param e The code being written
+/// @param sym The symbol to store to
+/// @param slot Where the value is, it stays there
+static void emit_store(emitter_t *e, jit_symbol_t *sym, int slot) {
+    emit_slot(e, "\x8b", 1, EDX, slot);
+    emit_bytes(e, "\x48\xb8", 2);       // mov rax, sym
+    emit_pointer(e, sym);
+    emit_bytes(e, "\x48\x8b\x48", 3);   // mov rcx, [rax + symbol]
+    emit_byte(e, offsetof(jit_symbol_t, symbol));
+    emit_bytes(e, "\x48\x85\xc9", 3);   // test rcx, rcx
+    size_t to_store = emit_short_jump(e, 0x74);
+    emit_bytes(e, "\x89\x51", 2);       // mov [rcx + val], edx
+    emit_byte(e, offsetof(symbol_t, val));
+    size_t to_done = emit_short_jump(e, 0xeb);
+
+    patch_short_jump(e, to_store);
+    emit_bytes(e, "\x48\x89\xc7", 3);   // mov rdi, rax
+    emit_bytes(e, "\x89\xd6", 2);       // mov esi, edx
+    emit_bytes(e, "\x48\x89\xda", 3);   // mov rdx, rbx
+    emit_call(e, (const void *)(uintptr_t)store_symbol);
+
+    patch_short_jump(e, to_done);
+}
+
+/// Emits the code for OP_DIV and OP_MOD.  The left side is on top,
+/// a zero divisor sets the error and gives -1.  A divisor of -1 never
+/// reaches idiv, which traps on INT_MIN / -1: the quotient is the
+/// negated dividend, wrapping around, and the remainder is 0.
+///
+/// @param e The code being written
+/// @param slot The slot of the divisor, where the result goes
+/// @param modulus Whether to keep the remainder instead of the quotient
+static void emit_divide(emitter_t *e, int slot, int modulus) {
+    emit_slot(e, "\x8b", 1, ECX, slot);
+    emit_bytes(e, "\x85\xc9", 2);       // test ecx, ecx
+    size_t to_zero = emit_short_jump(e, 0x74);
+    emit_slot(e, "\x8b", 1, EAX, slot + 1);
+    emit_bytes(e, "\x83\xf9\xff", 3);   // cmp ecx, -1
+    size_t to_divide = emit_short_jump(e, 0x75);
+    if (modulus) {
+        emit_bytes(e, "\x31\xc0", 2);   // xor eax, eax
+    }
+    else {
+        emit_bytes(e, "\xf7\xd8", 2);   // neg eax
+    }
+    size_t to_store = emit_short_jump(e, 0xeb);
+
+    patch_short_jump(e, to_divide);
+    emit_bytes(e, "\x99\xf7\xf9", 3);   // cdq; idiv ecx
+    if (modulus) {
+        emit_bytes(e, "\x89\xd0", 2);   // mov eax, edx
+    }
+    patch_short_jump(e, to_store);
+    emit_slot(e, "\x89", 1, EAX, slot);
+    size_t to_done = emit_short_jump(e, 0xeb);
+
+    patch_short_jump(e, to_zero);
+    emit_error(e, modulus ? INVALID_MODULUS : DIVISION_BY_ZERO);
+    emit_store_constant(e, slot, -1);
+
+    patch_short_jump(e, to_done);
+}
+
+int compile_jit(jit_code_t *jit, program_t *prog) {
+    init_jit(jit);
+    jit -> symbols = (jit_symbol_t *)tracked_malloc(prog -> length * sizeof(jit_symbol_t));
+    size_t *starts = (size_t *)tracked_malloc(prog -> length * sizeof(size_t));
+    size_t *jumps = (size_t *)tracked_malloc(prog -> length * sizeof(size_t));
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = PROLOGUE_BYTES + (size_t)prog -> length * MAX_INSTR_BYTES;
+    size = (size + page - 1) / page * page;
+    void *pages = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (jit -> symbols == NULL || starts == NULL || jumps == NULL || pages == MAP_FAILED) {
+        if (pages != MAP_FAILED) {
+            munmap(pages, size);
+        }
+        tracked_free(jumps);
+        tracked_free(starts);
+        free_jit(jit);
+        return -1;
+    }
+
+    emitter_t e = { (unsigned char *)pages, 0 };
+    int depth = 0;
+
+    // int code(int *stack, int *error), with the stack in r12 and the
+    // error in rbx, and rsp kept aligned for the helper calls
+    emit_bytes(&e, "\x53", 1);              // push rbx
+    emit_bytes(&e, "\x41\x54", 2);          // push r12
+    emit_bytes(&e, "\x48\x83\xec\x08", 4);  // sub rsp, 8
+    emit_bytes(&e, "\x49\x89\xfc", 3);      // mov r12, rdi
+    emit_bytes(&e, "\x48\x89\xf3", 3);      // mov rbx, rsi
+
+    for (int pc = 0; pc < prog -> length; pc++) {
+        instr_t *instr = &prog -> code[pc];
+        jit_symbol_t *sym = &jit -> symbols[pc];
+
+        starts[pc] = e.length;
+        jumps[pc] = 0;
+        sym -> name = instr -> name;
+        sym -> symbol = NULL;
+
+        switch (instr -> op) {
+            case OP_PUSH:
+                emit_store_constant(&e, depth++, instr -> arg);
+                break;
+            case OP_LOAD:
+                emit_load(&e, sym, depth++);
+                break;
+            case OP_STORE:
+                emit_store(&e, sym, depth - 1);
+                break;
+            case OP_ADD:
+                depth--;
+                emit_slot(&e, "\x8b", 1, EAX, depth - 1);
+                emit_slot(&e, "\x03", 1, EAX, depth);
+                emit_slot(&e, "\x89", 1, EAX, depth - 1);
+                break;
+            case OP_SUB:
+                depth--;
+                emit_slot(&e, "\x8b", 1, EAX, depth - 1);
+                emit_slot(&e, "\x2b", 1, EAX, depth);
+                emit_slot(&e, "\x89", 1, EAX, depth - 1);
+                break;
+            case OP_MUL:
+                depth--;
+                emit_slot(&e, "\x8b", 1, EAX, depth - 1);
+                emit_slot(&e, "\x0f\xaf", 2, EAX, depth);
+                emit_slot(&e, "\x89", 1, EAX, depth - 1);
+                break;
+            case OP_DIV:
+            case OP_MOD:
+                depth--;
+                emit_divide(&e, depth - 1, instr -> op == OP_MOD);
+                break;
+            case OP_JUMP_ZERO:
+                depth--;
+                emit_slot(&e, "\x8b", 1, EAX, depth);
+                emit_bytes(&e, "\x85\xc0\x0f\x84", 4);  // test eax, eax; jz
+                jumps[pc] = e.length;
+                emit_int(&e, 0);
+                break;
+            case OP_JUMP:
+                // Only one alternative runs, the other starts from the same depth
+                depth--;
+                emit_byte(&e, 0xe9);
+                jumps[pc] = e.length;
+                emit_int(&e, 0);
+                break;
+            case OP_ERROR:
+                emit_error(&e, instr -> arg);
+                break;
+            case OP_HALT:
+                emit_slot(&e, "\x8b", 1, EAX, depth - 1);
+                emit_bytes(&e, "\x48\x83\xc4\x08", 4);  // add rsp, 8
+                emit_bytes(&e, "\x41\x5c", 2);          // pop r12
+                emit_bytes(&e, "\x5b\xc3", 2);          // pop rbx; ret
+                break;
+        }
+    }
+
+    // Now that every instruction has an address the jumps can be aimed
+    for (int pc = 0; pc < prog -> length; pc++) {
+        if (jumps[pc]) {
+            int offset = (int)(starts[prog -> code[pc].arg] - (jumps[pc] + sizeof(int)));
+            memcpy(e.code + jumps[pc], &offset, sizeof(int));
+        }
+    }
+    tracked_free(jumps);
+    tracked_free(starts);
+
+    // The pages are never writable and executable at once
+    if (mprotect(pages, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(pages, size);
+        free_jit(jit);
+        return -1;
+    }
+    jit -> code = pages;
+    jit -> size = size;
+    jit -> length = prog -> length;
+    jit -> max_depth = prog -> max_depth;
+    jit -> version = table_version();
+    return 0;
+}
+
+int run_jit(jit_code_t *jit, vm_t *vm, eval_error_t *error) {
+    // Converted through a union, ISO C has no cast from data to code
+    union {
+        void *code;
+        int (*function)(int *stack, int *error);
+    } entry;
+    int status = EVAL_NONE;
+
+    reserve_vm(vm, jit -> max_depth);
+
+    // Bindings made before the table was rebuilt may be to freed symbols
+    if (jit -> version != table_version()) {
+        for (int i = 0; i < jit -> length; i++) {
+            jit -> symbols[i].symbol = NULL;
+        }
+        jit -> version = table_version();
+    }
+
+    entry.code = jit -> code;
+    int value = entry.function(vm -> stack, &status);
+    *error = (eval_error_t)status;
+    return value;
+}
+
+#define CHECK_DEPTH 6           // the deepest random expression checked
+#define CHECK_LINE 8192         // long enough for any expression that deep
+
+static unsigned int check_seed = 1;
+
+/// Picks a random number
+///
+/// @param n The number of choices
+/// @return Returns a number from 0 to n - 1
+static int pick(int n) {
+    // xorshift, so the expressions are the same on every platform
+    check_seed ^= check_seed << 13;
+    check_seed ^= check_seed >> 17;
+    check_seed ^= check_seed << 5;
+    return (int)(check_seed % n);
+}
+
+/// Writes a random postfix expression
+///
+/// @param dst Where to write it
+/// @param depth How much deeper it may nest
+/// @return Returns the end of what was written
+static char *random_expression(char *dst, int depth) {
+    static const char *leaves[] = { "a", "b", "c", "u", "0", "1", "2", "7", "100" };
+    static const char *ops[] = { "+", "-", "*", "/", "%", "?", "=" };
+
+    if (depth == 0 || pick(4) == 0) {
+        return dst + sprintf(dst, "%s ", leaves[pick(9)]);
+    }
+
+    const char *op = ops[pick(7)];
+    if (*op == '=') {
+        // Mostly symbols on the left, sometimes an operation (which
+        // is an error, but still assigns).  Never u, it must stay undefined.
+        if (pick(5)) {
+            dst += sprintf(dst, "%s ", leaves[pick(3)]);
+        }
+        else {
+            dst = random_expression(dst, depth - 1);
+            dst = random_expression(dst, depth - 1);
+            dst += sprintf(dst, "+ ");
+        }
+    }
+    else {
+        dst = random_expression(dst, depth - 1);
+    }
+    if (*op == '?') {
+        dst = random_expression(dst, depth - 1);
+    }
+    dst = random_expression(dst, depth - 1);
+    return dst + sprintf(dst, "%s ", op);
+}
+
+/// Gives a, b and c the values for the next check
+///
+/// @param values The values
+static void set_symbols(const int *values) {
+    lookup_table("a") -> val = values[0];
+    lookup_table("b") -> val = values[1];
+    lookup_table("c") -> val = values[2];
+}
+
+long check_jit(long count) {
+    static char *names[] = { "a", "b", "c" };
+    char line[CHECK_LINE];
+    program_t prog;
+    jit_code_t jit;
+    vm_t vm;
+    long mismatches = 0;
+
+    for (int i = 0; i < 3; i++) {
+        if (lookup_table(names[i]) == NULL) {
+            create_symbol(names[i], 0);
+        }
+    }
+    init_program(&prog);
+    init_vm(&vm);
+
+    for (long n = 0; n < count; n++) {
+        int start[3] = { pick(21) - 10, pick(21) - 10, pick(3) };
+        int after_tree[3];
+
+        char *end = random_expression(line, CHECK_DEPTH);
+        end[-1] = '\0';
+
+        // Some of them don't parse, like a number on the left of =
+        tree_node_t *tree = make_parse_tree(line);
+        if (default_context.parse_error != PARSE_NONE) {
+            default_context.parse_error = PARSE_NONE;
+            cleanup_tree(tree);
+            continue;
+        }
+
+        set_symbols(start);
+        int expected = eval_tree(tree);
+        eval_error_t expected_error = default_context.eval_error;
+        default_context.eval_error = EVAL_NONE;
+        for (int i = 0; i < 3; i++) {
+            after_tree[i] = lookup_table(names[i]) -> val;
+        }
+
+        set_symbols(start);
+        eval_error_t error;
+        if (compile_tree(&prog, optimize_tree(&default_context.arena, tree)) != 0 ||
+            compile_jit(&jit, &prog) != 0) {
+            fprintf(stderr, "Could not compile %s\n", line);
+            mismatches++;
+            cleanup_tree(tree);
+            continue;
+        }
+        int value = run_jit(&jit, &vm, &error);
+        free_jit(&jit);
+
+        int same = value == expected && error == expected_error;
+        for (int i = 0; i < 3; i++) {
+            same = same && lookup_table(names[i]) -> val == after_tree[i];
+        }
+        if (!same) {
+            fprintf(stderr, "Mismatch on %s: eval_tree gave %d (error %d), machine code gave %d (error %d)\n",
+                    line, expected, expected_error, value, error);
+            mismatches++;
+        }
+        cleanup_tree(tree);
+    }
+    free_vm(&vm);
+    free_program(&prog);
+    return mismatches;
+}
+
+#else
+
+int compile_jit(jit_code_t *jit, program_t *prog) {
+    (void)prog;
+    init_jit(jit);
+    return -1;
+}
+
+int run_jit(jit_code_t *jit, vm_t *vm, eval_error_t *error) {
+    (void)jit;
+    (void)vm;
+    *error = UNKNOWN_OPERATION;
+    return -1;
+}
+
+long check_jit(long count) {
+    (void)count;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,68 @@
+// Compiles programs to x86-64 machine code for the lines run most often
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include "bytecode.h"
+#include "symtab.h"
+
+/// A symbol the machine code loads or stores
+typedef struct jit_symbol_s {
+    char *name;                 ///< the name (from the program)
+    symbol_t *symbol;           ///< the symbol name was bound to (NULL until found)
+} jit_symbol_t;
+
+/// A program compiled to machine code
+typedef struct jit_code_s {
+    void *code;                 ///< the executable pages, NULL if not compiled
+    size_t size;                ///< the number of bytes mapped
+    jit_symbol_t *symbols;      ///< one for each instruction, named for OP_LOAD and OP_STORE
+    int length;                 ///< the number of instructions compiled
+    int max_depth;              ///< the deepest the value stack can get
+    unsigned long version;      ///< the table_version the symbols were bound in
+} jit_code_t;
+
+/// Turns on compiling cached lines to machine code the first time
+/// they are reused.  It has no effect where it isn't supported.
+void enable_jit(void);
+
+/// Tells whether cached lines should be compiled to machine code
+/// @return true if enable_jit was called and this is an x86-64 build
+int jit_enabled(void);
+
+/// Initializes a jit_code_t that holds no code
+/// @param jit The code to initialize
+void init_jit(jit_code_t *jit);
+
+/// Compiles a program to machine code in its own executable pages.
+/// The code gives the same results, errors and assignments as
+/// run_program, and binds its symbols the same way.  The names are
+/// not copied, so they must outlive the code, as a cache entry's do.
+/// @param jit The code to fill
+/// @param prog The program to compile
+/// @return 0 on success, -1 if this isn't an x86-64 build or the pages
+///     could not be mapped (run_program should be used instead)
+int compile_jit(jit_code_t *jit, program_t *prog);
+
+/// Runs compiled machine code
+/// @param jit The code to run
+/// @param vm The machine whose stack holds the values
+/// @param error Set to the eval error, or EVAL_NONE
+/// @return the value of the expression
+int run_jit(jit_code_t *jit, vm_t *vm, eval_error_t *error);
+
+/// Unmaps the code and frees the symbols
+/// @param jit The code to free
+void free_jit(jit_code_t *jit);
+
+/// Generates random expressions over the symbols a, b and c (made
+/// if they don't exist) and the undefined symbol u, and checks that
+/// the machine code for each gives the same value, error and
+/// assignments as eval_tree.  Each mismatch is displayed to
+/// standard error.
+/// @param count The number of expressions to check
+/// @return the number of mismatches, or -1 if this isn't an x86-64 build
+long check_jit(long count);
+
+#endif
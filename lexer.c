@@ -0,0 +1,95 @@
+#include <ctype.h>
+#include <limits.h>
+#include "lexer.h"
+
+/// Determines if the char is one of the acceptable operators
+///
+/// @param c The character to be checked
+/// @return Returns true if it is an operator
+static int isoperator(char c) {
+    switch(c){
+        case '+':
+        case '-':
+        case '*':
+        case '/':
+        case '%':
+        case '?':
+        case '=':
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+void init_lexer(lexer_t *lexer, const char *line) {
+    lexer -> line = line;
+    lexer -> pos = 0;
+}
+
+token_kind_t next_token(lexer_t *lexer, token_t *token) {
+    const char *line = lexer -> line;
+    int pos = lexer -> pos;
+    unsigned char c = line[pos];
+
+    token -> offset = pos;
+    token -> value = 0;
+
+    if (c == '\0') {
+        token -> length = 0;
+        return token -> kind = TOKEN_END;
+    }
+
+    // A comment runs to the end of the line, or through a newline
+    if (c == '#') {
+        while (line[pos] != '\0' && line[pos] != '\n') {
+            pos++;
+        }
+        if (line[pos] == '\n') {
+            pos++;
+        }
+        token -> length = pos - token -> offset;
+        lexer -> pos = pos;
+        return token -> kind = TOKEN_COMMENT;
+    }
+
+    // Read the whole run of characters, deciding the kind as we go
+    token_kind_t kind = isdigit(c) ? TOKEN_INTEGER
+                      : isalpha(c) ? TOKEN_SYMBOL
+                      : isoperator(c) ? TOKEN_OPERATOR : TOKEN_ILLEGAL;
+    unsigned long value = 0;
+
+    while ((c = line[pos]) != '\0' && c != ' ' && c != '#') {
+        if (isdigit(c)) {
+            // Saturate like strtol does, atoi then truncates to an int.
+            // Like atoi, only the leading digits count.
+            if (kind == TOKEN_INTEGER) {
+                unsigned long digit = c - '0';
+                value = value > (LONG_MAX - digit) / 10 ? LONG_MAX : value * 10 + digit;
+            }
+        }
+        else if (isalpha(c) || isoperator(c)) {
+            if (kind == TOKEN_INTEGER) {
+                kind = TOKEN_BAD_INTEGER;
+            }
+        }
+        else {
+            kind = TOKEN_ILLEGAL;
+        }
+        pos++;
+    }
+
+    token -> length = pos - token -> offset;
+    if (kind == TOKEN_OPERATOR && token -> length != 1) {
+        kind = TOKEN_ILLEGAL;
+    }
+    if (kind == TOKEN_INTEGER || kind == TOKEN_BAD_INTEGER) {
+        token -> value = (int)(long)value;
+    }
+
+    // A single space separates this token from the next one
+    if (c == ' ' && kind != TOKEN_ILLEGAL) {
+        pos++;
+    }
+    lexer -> pos = pos;
+    return token -> kind = kind;
+}
@@ -0,0 +1,49 @@
+// Single pass tokenizer for postfix expressions
+
+#ifndef LEXER_H
+#define LEXER_H
+
+/// What a token turned out to be
+typedef enum token_kind_e {
+    TOKEN_INTEGER,              ///< all digits, value holds what it parsed to
+    TOKEN_BAD_INTEGER,          ///< starts with a digit but has letters or operators too,
+                                ///< value holds what atoi gives for it
+    TOKEN_SYMBOL,               ///< starts with a letter
+    TOKEN_OPERATOR,             ///< a single operator character
+    TOKEN_COMMENT,              ///< from # to the end of the line
+    TOKEN_ILLEGAL,              ///< doesn't fit any other pattern
+    TOKEN_END                   ///< no more input
+} token_kind_t;
+
+/// A token, as a span of the input line
+typedef struct token_s {
+    token_kind_t kind;          ///< the kind of token
+    int offset;                 ///< index of the first character in the line
+    int length;                 ///< number of characters in the token
+    int value;                  ///< the value of a TOKEN_INTEGER, as atoi gives it
+} token_t;
+
+/// The position of the tokenizer in a line
+typedef struct lexer_s {
+    const char *line;           ///< the line being read (null terminated)
+    int pos;                    ///< index of the next character to read
+} lexer_t;
+
+/// Starts reading tokens from a line.  Nothing is copied or allocated,
+/// the tokens refer back into the line.
+/// @param lexer The tokenizer to start
+/// @param line The line to read
+void init_lexer(lexer_t *lexer, const char *line);
+
+/// Reads the next token.  Tokens are separated by exactly one space;
+/// a space anywhere else, or any character that is not a letter, digit
+/// or operator, makes a TOKEN_ILLEGAL, as does an operator longer than
+/// one character.  A token starting with a digit that has letters or
+/// operators after it is a TOKEN_BAD_INTEGER, which the parser reports
+/// or not depending on what follows it.
+/// @param lexer The tokenizer to read from
+/// @param token Filled in with the token
+/// @return the kind of the token
+token_kind_t next_token(lexer_t *lexer, token_t *token);
+
+#endif
@@ -0,0 +1,233 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "optimize.h"
+#include "stack.h"
+
+/// Reports running out of memory for a line's tree and exits
+static void out_of_memory(void) {
+    fprintf(stderr, "Could not allocate memory for the expression\n");
+    exit(EXIT_FAILURE);
+}
+
+/// Tells whether a node is an integer literal
+///
+/// @param node The node to check
+/// @return Returns true if the node is an INTEGER leaf
+static int is_constant(tree_node_t *node) {
+    return node -> type == LEAF && ((leaf_node_t *)node -> node) -> exp_type == INTEGER;
+}
+
+/// Tells whether a node is a particular integer literal
+///
+/// @param node The node to check
+/// @param value The value it should have
+/// @return Returns true if the node is an INTEGER leaf with that value
+static int is_value(tree_node_t *node, int value) {
+    return is_constant(node) && ((leaf_node_t *)node -> node) -> value == value;
+}
+
+/// Makes the literal for a folded value
+///
+/// @param arena The arena to allocate from
+/// @param value The value of the literal
+/// @return Returns the new leaf
+static tree_node_t *make_constant(arena_t *arena, int value) {
+    char digits[16];
+    int len = snprintf(digits, sizeof(digits), "%d", value);
+    char *token = arena_strndup(arena, digits, len);
+    tree_node_t *leaf;
+
+    if (token == NULL || (leaf = make_leaf(arena, INTEGER, token, value)) == NULL) {
+        out_of_memory();
+    }
+    return leaf;
+}
+
+/// Folds an operation on two literals the way evaluation would compute it
+///
+/// @param op The operation
+/// @param left The value of the left operand
+/// @param right The value of the right operand
+/// @param result Set to the value of the operation
+/// @return Returns true if it was folded, false if it must be left
+///     to evaluation (division by zero and overflowing division)
+static int fold(op_type_t op, int left, int right, int *result) {
+    // Wrap around on overflow like the machine does, without the
+    // undefined behaviour of signed overflow here
+    switch (op) {
+        case ADD_OP:
+            *result = (int)((unsigned int)left + (unsigned int)right);
+            return 1;
+        case SUB_OP:
+            *result = (int)((unsigned int)left - (unsigned int)right);
+            return 1;
+        case MUL_OP:
+            *result = (int)((unsigned int)left * (unsigned int)right);
+            return 1;
+        case DIV_OP:
+        case MOD_OP:
+            if (right == 0 || (left == INT_MIN && right == -1)) {
+                return 0;
+            }
+            *result = op == DIV_OP ? left / right : left % right;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/// Takes the top of a stack of optimized nodes
+///
+/// @param results The stack
+/// @return Returns the node that was on top
+static tree_node_t *take(stack_t *results) {
+    return (tree_node_t *)results -> data[--results -> size];
+}
+
+/// Simplifies an interior node once its operands are simplified
+///
+/// @param arena The arena to allocate new nodes from
+/// @param tree The node as written
+/// @param results The simplified operands, in the order optimize_tree
+///     visits them, on top (taken off)
+/// @return Returns the simplified node
+static tree_node_t *simplify(arena_t *arena, tree_node_t *tree, stack_t *results) {
+    interior_node_t *interior = (interior_node_t *)tree -> node;
+    op_type_t op = interior -> op;
+    tree_node_t *left = interior -> left;
+    tree_node_t *right = interior -> right;
+    int value;
+
+    switch (op) {
+        case ADD_OP:
+        case SUB_OP:
+        case MUL_OP:
+        case DIV_OP:
+        case MOD_OP:
+            right = take(results);
+            left = take(results);
+
+            if (is_constant(left) && is_constant(right) &&
+                fold(op, ((leaf_node_t *)left -> node) -> value,
+                     ((leaf_node_t *)right -> node) -> value, &value)) {
+                return make_constant(arena, value);
+            }
+
+            // Identities only drop a literal, so the other side's
+            // errors and assignments still happen
+            if ((op == ADD_OP || op == SUB_OP) && is_value(right, 0)) {
+                return left;
+            }
+            if ((op == MUL_OP || op == DIV_OP) && is_value(right, 1)) {
+                return left;
+            }
+            if ((op == ADD_OP && is_value(left, 0)) || (op == MUL_OP && is_value(left, 1))) {
+                return right;
+            }
+            break;
+        case ASSIGN_OP:
+            // The left side names the symbol, so it stays as written
+            right = take(results);
+            break;
+        default: {
+            // Only a ? is left
+            interior_node_t *alt = (interior_node_t *)right -> node;
+            left = take(results);
+            tree_node_t *alt_right = take(results);
+            tree_node_t *alt_left = take(results);
+
+            if (is_constant(left)) {
+                return ((leaf_node_t *)left -> node) -> value ? alt_left : alt_right;
+            }
+            if (alt_left != alt -> left || alt_right != alt -> right) {
+                if ((right = make_interior(arena, ALT_OP, alt_left, alt_right)) == NULL) {
+                    out_of_memory();
+                }
+            }
+            break;
+        }
+    }
+
+    // Share the node when nothing under it changed
+    if (left == interior -> left && right == interior -> right) {
+        return tree;
+    }
+    tree_node_t *node = make_interior(arena, op, left, right);
+    if (node == NULL) {
+        out_of_memory();
+    }
+    return node;
+}
+
+// Marks the node under it on the work stack as having its operands done
+static char simplify_marker;
+#define SIMPLIFY ((void *)&simplify_marker)
+
+/// Goes down the first operands of a tree, leaving each interior node
+/// on the way on the work stack under a SIMPLIFY and its other operands
+///
+/// @param work The work stack of optimize_tree
+/// @param node The node to start from
+/// @return Returns the node at the bottom, which needs no simplifying
+static tree_node_t *descend(stack_t *work, tree_node_t *node) {
+    while (node -> type == INTERIOR) {
+        interior_node_t *interior = (interior_node_t *)node -> node;
+
+        switch (interior -> op) {
+            case ADD_OP:
+            case SUB_OP:
+            case MUL_OP:
+            case DIV_OP:
+            case MOD_OP:
+                push(work, node);
+                push(work, SIMPLIFY);
+                push(work, interior -> right);
+                node = interior -> left;
+                break;
+            case ASSIGN_OP:
+                push(work, node);
+                push(work, SIMPLIFY);
+                node = interior -> right;
+                break;
+            case Q_OP: {
+                interior_node_t *alt = (interior_node_t *)interior -> right -> node;
+                push(work, node);
+                push(work, SIMPLIFY);
+                push(work, interior -> left);
+                push(work, alt -> right);
+                node = alt -> left;
+                break;
+            }
+            default:
+                return node;
+        }
+    }
+    return node;
+}
+
+tree_node_t *optimize_tree(arena_t *arena, tree_node_t *tree) {
+    void *work_slots[STACK_LOCAL], *result_slots[STACK_LOCAL];
+    stack_t work, results;
+
+    // The nodes still to visit are on work, the simplified nodes on
+    // results, so no depth of tree can run out of native stack
+    init_stack(&work, STACK_BORROWS, work_slots, STACK_LOCAL);
+    init_stack(&results, STACK_BORROWS, result_slots, STACK_LOCAL);
+    push(&results, descend(&work, tree));
+    while (work.size > 0) {
+        tree_node_t *node = (tree_node_t *)work.data[--work.size];
+
+        if (node == SIMPLIFY) {
+            node = (tree_node_t *)work.data[--work.size];
+            push(&results, simplify(arena, node, &results));
+        }
+        else {
+            push(&results, descend(&work, node));
+        }
+    }
+    tree = take(&results);
+    release_stack(&work);
+    release_stack(&results);
+    return tree;
+}
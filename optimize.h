@@ -0,0 +1,22 @@
+// Constant folding and algebraic simplification of parse trees
+
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "tree_node.h"
+
+/// Builds a simplified copy of the tree that evaluates to the same
+/// value with the same errors and assignments.  Constant subtrees are
+/// folded, x+0, 0+x, x-0, x*1, 1*x and x/1 become x, and a ? with a
+/// constant condition becomes the chosen alternative.  Division or
+/// modulus by a constant zero is left for evaluation to report.
+/// The original tree is not changed, so it can still be printed;
+/// unchanged subtrees are shared between the two.
+/// @param arena The arena to allocate the new nodes from
+/// @param tree The root of a tree without parse errors
+/// @return the root of the simplified tree
+/// @exception If the arena can't grow, an error message is displayed
+///     to standard error and the program exits with EXIT_FAILURE
+tree_node_t *optimize_tree(arena_t *arena, tree_node_t *tree);
+
+#endif
@@ -0,0 +1,225 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "output.h"
+#include "alloc.h"
+#include "parser.h"
+
+// The two digits of every number under 100, for output_int
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static output_t standard;
+static int standard_ready;
+
+void init_output(output_t *out, int fd, int interactive) {
+    out -> fd = fd;
+    out -> buf = NULL;
+    out -> len = 0;
+    out -> size = 0;
+    out -> interactive = interactive;
+    out -> mode = OUTPUT_TEXT;
+}
+
+/// Writes all of a buffer to a file descriptor
+///
+/// @param fd Where to write
+/// @param text The bytes
+/// @param len The number of bytes
+/// @return Returns 0 on success, -1 if the write failed
+static int write_all(int fd, const char *text, size_t len) {
+    while (len > 0) {
+        ssize_t wrote = write(fd, text, len);
+        if (wrote < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        text += wrote;
+        len -= wrote;
+    }
+    return 0;
+}
+
+/// Writes what is left on standard output as the program exits
+static void flush_standard(void) {
+    write_all(standard.fd, standard.buf, standard.len);
+    standard.len = 0;
+}
+
+output_t *standard_output(void) {
+    if (!standard_ready) {
+        init_output(&standard, STDOUT_FILENO, isatty(STDOUT_FILENO));
+        atexit(flush_standard);
+        standard_ready = 1;
+    }
+    return &standard;
+}
+
+void flush_output(output_t *out) {
+    if (out -> fd < 0) {
+        return;
+    }
+    if (write_all(out -> fd, out -> buf, out -> len) != 0) {
+        perror("Error writing the output");
+        exit(EXIT_FAILURE);
+    }
+    out -> len = 0;
+}
+
+/// Makes room for more text, writing out what is there when the
+/// buffer is full, or growing the buffer if the text is kept in memory
+///
+/// @param out The output
+/// @param len The number of bytes about to be added
+/// @return Returns where to put them
+static char *reserve(output_t *out, size_t len) {
+    if (out -> len + len > out -> size) {
+        flush_output(out);
+
+        // A single piece of text bigger than a block gets a bigger buffer
+        if (out -> len + len > out -> size) {
+            size_t size = out -> size ? out -> size : OUTPUT_BLOCK;
+            while (size < out -> len + len) {
+                size *= 2;
+            }
+            char *buf = (char *)tracked_realloc(out -> buf, size);
+            if (buf == NULL) {
+                fprintf(stderr, "Could not allocate memory for the output\n");
+                exit(EXIT_FAILURE);
+            }
+            out -> buf = buf;
+            out -> size = size;
+        }
+    }
+    return out -> buf + out -> len;
+}
+
+/// Finishes a call that added text, writing it out straight away
+/// when a terminal is waiting on it
+///
+/// @param out The output
+static void added(output_t *out) {
+    if (out -> interactive) {
+        flush_output(out);
+    }
+}
+
+/// Formats an integer in decimal, two digits at a time
+///
+/// @param dst Where to write it, at least 11 characters
+/// @param value The integer
+/// @return Returns the number of characters written
+static size_t format_int(char *dst, int value) {
+    char digits[12], *end = digits + sizeof(digits), *p = end;
+    unsigned int n = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+    while (n >= 100) {
+        unsigned int pair = (n % 100) * 2;
+        n /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (n >= 10) {
+        *--p = digit_pairs[n * 2 + 1];
+        *--p = digit_pairs[n * 2];
+    }
+    else {
+        *--p = '0' + n;
+    }
+    if (value < 0) {
+        *--p = '-';
+    }
+    memcpy(dst, p, end - p);
+    return end - p;
+}
+
+void output_bytes(output_t *out, const char *text, size_t len) {
+    memcpy(reserve(out, len), text, len);
+    out -> len += len;
+    added(out);
+}
+
+void output_str(output_t *out, const char *text) {
+    output_bytes(out, text, strlen(text));
+}
+
+void output_int(output_t *out, int value) {
+    out -> len += format_int(reserve(out, 11), value);
+    added(out);
+}
+
+void output_infix(output_t *out, tree_node_t *node) {
+    size_t len = infix_length(node);
+
+    format_infix(node, reserve(out, len));
+    out -> len += len;
+    added(out);
+}
+
+void output_result(output_t *out, tree_node_t *tree, int value) {
+    size_t len = out -> mode == OUTPUT_VALUES ? 0 : infix_length(tree);
+
+    // The whole line goes in the buffer at once, the number is at most
+    // 11 characters and the rest is " = " or a tab and the newline
+    char *dst = reserve(out, len + 15), *start = dst;
+    switch (out -> mode) {
+        case OUTPUT_TEXT:
+            dst = format_infix(tree, dst);
+            memcpy(dst, " = ", 3);
+            dst += 3;
+            dst += format_int(dst, value);
+            break;
+        case OUTPUT_VALUES:
+            dst += format_int(dst, value);
+            break;
+        case OUTPUT_COMPACT:
+            dst += format_int(dst, value);
+            *dst++ = '\t';
+            dst = format_infix(tree, dst);
+            break;
+    }
+    *dst++ = '\n';
+    out -> len += dst - start;
+    added(out);
+}
+
+void output_infix_result(output_t *out, const char *infix, int value) {
+    size_t len = out -> mode == OUTPUT_VALUES ? 0 : strlen(infix);
+
+    char *dst = reserve(out, len + 15), *start = dst;
+    switch (out -> mode) {
+        case OUTPUT_TEXT:
+            memcpy(dst, infix, len);
+            memcpy(dst + len, " = ", 3);
+            dst += len + 3;
+            dst += format_int(dst, value);
+            break;
+        case OUTPUT_VALUES:
+            dst += format_int(dst, value);
+            break;
+        case OUTPUT_COMPACT:
+            dst += format_int(dst, value);
+            *dst++ = '\t';
+            memcpy(dst, infix, len);
+            dst += len;
+            break;
+    }
+    *dst++ = '\n';
+    out -> len += dst - start;
+    added(out);
+}
+
+void free_output(output_t *out) {
+    flush_output(out);
+    tracked_free(out -> buf);
+    out -> buf = NULL;
+    out -> size = 0;
+}
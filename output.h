@@ -0,0 +1,86 @@
+// Buffered output of results, written to a file descriptor in large blocks
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include "tree_node.h"
+
+#define OUTPUT_BLOCK (1 << 16)  // bytes buffered before they are written
+
+/// What is printed for each line that evaluates without an error
+typedef enum output_mode_e {
+    OUTPUT_TEXT,                ///< "infix = value", the interpreter's own format
+    OUTPUT_VALUES,              ///< just the value
+    OUTPUT_COMPACT              ///< the value, a tab, then the infix
+} output_mode_t;
+
+/// A buffer of text on its way to a file descriptor
+typedef struct output_s {
+    int fd;                     ///< where the text is written, or -1 to keep it in buf
+    char *buf;                  ///< the text not yet written
+    size_t len;                 ///< the number of bytes in buf
+    size_t size;                ///< the number of bytes allocated for buf
+    int interactive;            ///< write after every call rather than in blocks
+    output_mode_t mode;         ///< how results are printed
+} output_t;
+
+/// Initializes an empty buffer.  Nothing is allocated until the first
+/// text is added.
+/// @param out The output to initialize
+/// @param fd The file descriptor to write to, or -1 to keep all of the
+///     text in the buffer, growing it as needed, for the owner to take
+///     out of buf and len itself
+/// @param interactive Whether to write the text out after every call,
+///     for a terminal, instead of once a block has built up
+void init_output(output_t *out, int fd, int interactive);
+
+/// The output on standard output, which is interactive if it is a
+/// terminal.  It is flushed when the program exits.
+/// @return the standard output
+output_t *standard_output(void);
+
+/// Adds bytes to the output
+/// @param out The output
+/// @param text The bytes (need not be null terminated)
+/// @param len The number of bytes
+void output_bytes(output_t *out, const char *text, size_t len);
+
+/// Adds a string to the output
+/// @param out The output
+/// @param text The string
+void output_str(output_t *out, const char *text);
+
+/// Adds an integer in decimal, as printf's %d would
+/// @param out The output
+/// @param value The integer
+void output_int(output_t *out, int value);
+
+/// Adds the infix text for a tree, the same as print_infix displays
+/// @param out The output
+/// @param node The root of the tree
+void output_infix(output_t *out, tree_node_t *node);
+
+/// Adds the result of a line in the output's mode
+/// @param out The output
+/// @param tree The line's tree
+/// @param value What the line evaluated to
+void output_result(output_t *out, tree_node_t *tree, int value);
+
+/// Adds the result of a line in the output's mode, given its infix text
+/// @param out The output
+/// @param infix What print_infix displays for the line
+/// @param value What the line evaluated to
+void output_infix_result(output_t *out, const char *infix, int value);
+
+/// Writes everything buffered so far.  Text kept in memory stays put.
+/// @param out The output
+/// @exception If the text can't be written, an error message is
+///     displayed to standard error and the program exits with EXIT_FAILURE
+void flush_output(output_t *out);
+
+/// Writes everything buffered, and releases the buffer
+/// @param out The output
+void free_output(output_t *out);
+
+#endif
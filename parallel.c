@@ -0,0 +1,375 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parallel.h"
+#include "alloc.h"
+#include "parser.h"
+#include "context.h"
+#include "bytecode.h"
+#include "optimize.h"
+#include "output.h"
+#include "stats.h"
+#include "symtab.h"
+
+/// Everything known about one line of the batch
+typedef struct job_s {
+    tree_node_t *tree;          ///< the parse tree, NULL on a parse error
+    parse_error_t parse_error;  ///< what went wrong parsing the line
+    int compiled;               ///< whether program holds the tree
+    program_t program;          ///< the tree compiled for the machine
+    int value;                  ///< the value the line evaluated to
+    eval_error_t eval_error;    ///< what went wrong evaluating the line
+} job_t;
+
+/// The names of the symbols read or written by a run of lines
+typedef struct name_set_s {
+    char **slots;               ///< open-addressing table of names
+    int *used;                  ///< which slots are filled, for clearing
+    int count;                  ///< the number of names in the set
+    int size;                   ///< the number of slots (a power of two)
+} name_set_t;
+
+static job_t *jobs;
+static int max_jobs;
+
+static name_set_t reads, writes;
+
+// The pool, and the run of jobs it is currently working on
+static pthread_t *workers;
+static int num_workers;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+static int generation, stopping, unfinished;
+static int run_begin, run_end;
+
+// The calling thread's machine, each worker has its own
+static vm_t main_vm;
+
+/// Evaluates the jobs in [begin, end)
+///
+/// @param vm The machine to run them on
+/// @param begin The first job
+/// @param end One past the last job
+static void eval_jobs(vm_t *vm, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        if (jobs[i].tree) {
+            long long start = start_timer();
+            jobs[i].value = run_program(vm, &jobs[i].program, &jobs[i].eval_error);
+            stop_timer(TIME_EVAL, start);
+        }
+    }
+}
+
+/// Finds this thread's share of the current run
+///
+/// @param slice The index of the thread, 0 being the calling thread
+/// @param begin Set to the first job of the share
+/// @param end Set to one past the last job of the share
+static void share_of_run(int slice, int *begin, int *end) {
+    int length = run_end - run_begin, threads = num_workers + 1;
+
+    *begin = run_begin + (int)((long)length * slice / threads);
+    *end = run_begin + (int)((long)length * (slice + 1) / threads);
+}
+
+/// The body of every worker thread
+///
+/// @param arg The slice of each run this worker takes (as an intptr)
+/// @return Returns NULL
+static void *work(void *arg) {
+    int slice = (int)(size_t)arg, seen = 0, begin, end;
+    vm_t vm;
+
+    init_vm(&vm);
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (generation == seen && !stopping) {
+            pthread_cond_wait(&work_ready, &lock);
+        }
+        if (stopping) {
+            break;
+        }
+        seen = generation;
+        share_of_run(slice, &begin, &end);
+        pthread_mutex_unlock(&lock);
+
+        eval_jobs(&vm, begin, end);
+
+        pthread_mutex_lock(&lock);
+        if (--unfinished == 0) {
+            pthread_cond_signal(&work_done);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    free_vm(&vm);
+    return NULL;
+}
+
+void start_workers(int threads) {
+    num_workers = threads - 1;
+    workers = (pthread_t *)tracked_malloc(sizeof(pthread_t) * (num_workers > 0 ? num_workers : 1));
+    if (workers == NULL) {
+        fprintf(stderr, "Could not allocate the worker threads\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        if (pthread_create(&workers[i], NULL, work, (void *)(size_t)(i + 1)) != 0) {
+            fprintf(stderr, "Could not start the worker threads\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    init_vm(&main_vm);
+}
+
+void stop_workers(void) {
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_broadcast(&work_ready);
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    tracked_free(workers);
+    free_vm(&main_vm);
+    for (int i = 0; i < max_jobs; i++) {
+        free_program(&jobs[i].program);
+    }
+    tracked_free(jobs);
+    tracked_free(reads.slots);
+    tracked_free(reads.used);
+    tracked_free(writes.slots);
+    tracked_free(writes.used);
+}
+
+/// Evaluates the jobs in [begin, end) across the whole pool
+///
+/// @param begin The first job
+/// @param end One past the last job
+static void eval_run(int begin, int end) {
+    // Waking the pool costs more than evaluating a short run
+    if (num_workers == 0 || end - begin < MIN_PARALLEL_RUN) {
+        eval_jobs(&main_vm, begin, end);
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    run_begin = begin;
+    run_end = end;
+    unfinished = num_workers;
+    generation++;
+    pthread_cond_broadcast(&work_ready);
+    share_of_run(0, &begin, &end);
+    pthread_mutex_unlock(&lock);
+
+    eval_jobs(&main_vm, begin, end);
+
+    pthread_mutex_lock(&lock);
+    while (unfinished > 0) {
+        pthread_cond_wait(&work_done, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/// Empties a set of names, keeping its slots
+///
+/// @param set The set to empty
+static void clear_names(name_set_t *set) {
+    for (int i = 0; i < set -> count; i++) {
+        set -> slots[set -> used[i]] = NULL;
+    }
+    set -> count = 0;
+}
+
+/// Finds the slot holding name, or the empty slot where it belongs
+///
+/// @param set The set to search
+/// @param name The name to look for
+/// @return Returns the index of the slot
+static int find_name(name_set_t *set, char *name) {
+    int mask = set -> size - 1;
+    int i = (int)(hash_name(name) & (unsigned int)mask);
+
+    while (set -> slots[i] && strcmp(set -> slots[i], name)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/// Tells whether a name is in the set
+///
+/// @param set The set to search
+/// @param name The name to look for
+/// @return Returns true if the name is in the set
+static int has_name(name_set_t *set, char *name) {
+    return set -> count > 0 && set -> slots[find_name(set, name)] != NULL;
+}
+
+/// Adds a name to the set, growing it to stay at most half full
+///
+/// @param set The set to add to
+/// @param name The name to add
+static void add_name(name_set_t *set, char *name) {
+    if ((set -> count + 1) * 2 > set -> size) {
+        name_set_t old = *set;
+
+        set -> size = old.size ? old.size * 2 : 64;
+        set -> slots = (char **)tracked_calloc(set -> size, sizeof(char *));
+        set -> used = (int *)tracked_malloc(sizeof(int) * set -> size / 2);
+        set -> count = 0;
+        if (set -> slots == NULL || set -> used == NULL) {
+            fprintf(stderr, "Could not allocate the symbol sets\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < old.count; i++) {
+            add_name(set, old.slots[old.used[i]]);
+        }
+        tracked_free(old.slots);
+        tracked_free(old.used);
+    }
+
+    int i = find_name(set, name);
+    if (set -> slots[i] == NULL) {
+        set -> slots[i] = name;
+        set -> used[set -> count++] = i;
+    }
+}
+
+/// Tells whether a job can join the current run, which it can't if it
+/// writes something the run reads or writes, or reads something the run
+/// writes.  A job that creates a symbol, or couldn't be compiled, can't
+/// run alongside anything.
+///
+/// @param job The job to check
+/// @param alone Set to true if the job must be evaluated on its own
+/// @return Returns true if the job conflicts with the run
+static int conflicts(job_t *job, int *alone) {
+    *alone = 0;
+    if (job -> tree == NULL) {
+        return 0;
+    }
+    if (!job -> compiled) {
+        *alone = 1;
+        return 1;
+    }
+
+    instr_t *code = job -> program.code;
+    for (int i = 0; i < job -> program.length; i++) {
+        if (code[i].op == OP_LOAD && has_name(&writes, code[i].name)) {
+            return 1;
+        }
+        if (code[i].op == OP_STORE) {
+            if (lookup_table(code[i].name) == NULL) {
+                *alone = 1;
+                return 1;
+            }
+            if (has_name(&reads, code[i].name) || has_name(&writes, code[i].name)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/// Adds the symbols a job uses to the current run
+///
+/// @param job The job joining the run
+static void join_run(job_t *job) {
+    if (job -> tree == NULL) {
+        return;
+    }
+
+    instr_t *code = job -> program.code;
+    for (int i = 0; i < job -> program.length; i++) {
+        if (code[i].op == OP_LOAD) {
+            add_name(&reads, code[i].name);
+        }
+        else if (code[i].op == OP_STORE) {
+            add_name(&writes, code[i].name);
+        }
+    }
+}
+
+void rep_parallel(char **lines, int count) {
+    if (count > max_jobs) {
+        job_t *more = (job_t *)tracked_realloc(jobs, sizeof(job_t) * count);
+        if (more == NULL) {
+            fprintf(stderr, "Could not allocate the batch\n");
+            exit(EXIT_FAILURE);
+        }
+        jobs = more;
+        for (int i = max_jobs; i < count; i++) {
+            init_program(&jobs[i].program);
+        }
+        max_jobs = count;
+    }
+
+    // Parse and compile everything first, the trees stay in the arena
+    for (int i = 0; i < count; i++) {
+        job_t *job = &jobs[i];
+        long long start = start_timer();
+
+        STAT_ADD(expressions, 1);
+        job -> tree = make_parse_tree(lines[i]);
+        stop_timer(TIME_PARSE, start);
+        job -> parse_error = default_context.parse_error;
+        job -> eval_error = EVAL_NONE;
+        default_context.parse_error = PARSE_NONE;
+        if (job -> parse_error != PARSE_NONE) {
+            job -> tree = NULL;
+            continue;
+        }
+        start = start_timer();
+        job -> compiled = compile_tree(&job -> program, optimize_tree(&default_context.arena, job -> tree)) == 0;
+        stop_timer(TIME_COMPILE, start);
+    }
+
+    // Evaluate the runs of independent lines in order
+    int i = 0, alone;
+    while (i < count) {
+        if (conflicts(&jobs[i], &alone) && alone) {
+            job_t *job = &jobs[i++];
+            long long start = start_timer();
+            if (job -> compiled) {
+                job -> value = run_program(&main_vm, &job -> program, &job -> eval_error);
+            }
+            else {
+                job -> value = eval_tree(job -> tree);
+                job -> eval_error = default_context.eval_error;
+                default_context.eval_error = EVAL_NONE;
+            }
+            stop_timer(TIME_EVAL, start);
+            continue;
+        }
+
+        int begin = i;
+        clear_names(&reads);
+        clear_names(&writes);
+        while (i < count && !conflicts(&jobs[i], &alone)) {
+            join_run(&jobs[i++]);
+        }
+        eval_run(begin, i);
+    }
+
+    // Print everything in the order of the lines
+    for (i = 0; i < count; i++) {
+        job_t *job = &jobs[i];
+
+        if (job -> parse_error != PARSE_NONE) {
+            report_parse_error(job -> parse_error);
+        }
+        else if (job -> eval_error != EVAL_NONE) {
+            report_eval_error(job -> eval_error);
+        }
+        else {
+            long long start = start_timer();
+            output_result(standard_output(), job -> tree, job -> value);
+            stop_timer(TIME_PRINT, start);
+        }
+    }
+    cleanup_tree(NULL);
+}
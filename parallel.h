@@ -0,0 +1,28 @@
+// Multi-threaded evaluation of batches of independent expressions
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#define MIN_PARALLEL_RUN 256    // shorter runs are evaluated on the calling thread
+
+/// Starts the pool of threads used by rep_parallel
+/// @param threads The total number of threads to evaluate with,
+///     including the calling thread
+/// @exception If the threads can't be created, an error message is
+///     displayed to standard error and the program exits with EXIT_FAILURE
+void start_workers(int threads);
+
+/// Has the same effect as calling rep on each line in order: the
+/// output comes out in line order and the symbol table ends up the
+/// same.  All the lines are parsed first, then consecutive lines that
+/// don't write a symbol another of them reads or writes are evaluated
+/// together across the pool.  A line that creates a new symbol is
+/// evaluated on its own, since that changes the table's index.
+/// @param lines The lines to evaluate (null terminated)
+/// @param count The number of lines
+void rep_parallel(char **lines, int count);
+
+/// Stops and joins the threads started by start_workers
+void stop_workers(void);
+
+#endif
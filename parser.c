@@ -1,508 +1,695 @@
 #include <stdlib.h>
-#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include "parser.h"
+#include "alloc.h"
+#include "arena.h"
+#include "bytecode.h"
+#include "optimize.h"
+#include "output.h"
+#include "cache.h"
+#include "context.h"
+#include "intern.h"
+#include "jit.h"
+#include "reactive.h"
 #include "stack.h"
+#include "stats.h"
 #include "tree_node.h"
 #include "symtab.h"
 
-#define MAX_TOKEN 100
-
-// These will be used for tracking any errors that occur in the program
-parse_error_t parse_error = PARSE_NONE;
-eval_error_t eval_error = EVAL_NONE;
+/// Displays the message for a parse error
+///
+/// @param err Where to display it
+/// @param error The error to report
+static void write_parse_error(FILE *err, parse_error_t error) {
+    STAT_ADD(parse_errors[error], 1);
+    switch(error){  
+        case TOO_FEW_TOKENS:
+            fprintf(err, "Not enough tokens in expression!\n");
+            break;
+        case TOO_MANY_TOKENS:
+            fprintf(err, "Too many tokens in expression!\n");
+            break;
+        case INVALID_ASSIGNMENT: 
+            fprintf(err, "Assign to left hand side not a variable!\n");
+            break;
+        case ILLEGAL_TOKEN:
+            fprintf(err, "Illegal token is present!\n");
+            break;
+        default:
+            fprintf(err, "Unkown error occured!\n");
+            break;
+    }
+}
 
-// Used for keeping track of state when reading in the parse tree
-typedef enum parse_tree_e {
-    READING,
-    READ,
-    COMMENT,
-    ERROR
-} parse_tree_t;
+void report_parse_error(parse_error_t error) {
+    write_parse_error(context_err(&default_context), error);
+}
 
-/// Determines if the char is one of the acceptable operators
+/// Displays the message for an evaluation error
 ///
-/// @param operator The symbol to be checked
-/// @return Returns true if it is an operator
-int isoperand(char operator){
-    switch(operator){
-        case '+':
-        case '-':
-        case '*':
-        case '/':
-        case '%':
-        case '?':
-        case '=':
-            return 1;
+/// @param err Where to display it
+/// @param error The error to report
+static void write_eval_error(FILE *err, eval_error_t error) {
+    STAT_ADD(eval_errors[error], 1);
+    switch(error) {
+        case DIVISION_BY_ZERO:
+            fprintf(err, "Division by zero\n");
+            break;
+        case INVALID_MODULUS:
+            fprintf(err, "Division by zero\n");
+            break;
+        case UNDEFINED_SYMBOL:
+            fprintf(err, "Symbol is not in the table!\n");
+            break;
+        case UNKNOWN_OPERATION:
+            fprintf(err, "Operation is unknown!\n");
+            break;
+        case UNKNOWN_EXP_TYPE:
+            fprintf(err, "Unknown expression type\n");            
+            break;        
+        case MISSING_LVALUE:
+            fprintf(err, "Missing a value on the left!\n");
+            break;
+        case INVALID_LVALUE:
+            fprintf(err, "Invalid value on the left\n");
+            break;
+        case SYMTAB_FULL:
+            fprintf(err, "Could not make symbol, symbol table is full!\n");
+            break;
         default:
-            return 0;
+            fprintf(err, "A unknown error occured!\n");
+            break;
     }
 }
 
-/// Used to see if the string is all numbers
+void report_eval_error(eval_error_t error) {
+    write_eval_error(context_err(&default_context), error);
+}
+
+/// Evaluates a line that was found in the cache
 ///
-/// @param string The string to check if it is all numbers
-/// @return Returns true if the entire string is a number
-int isstringdigit(char *string){
-    int isstringdigit = 1;
-    for (int i = 0; i < (int)strlen(string); i++) {
-        if (isdigit(string[i]) != 0){
-            isstringdigit *= 1;
-        }
-        else {
-            isstringdigit *= 0;
-        }
+/// @param entry The cached line
+void rep_cached(cache_entry_t *entry) {
+    if (entry -> parse_error != PARSE_NONE){
+        report_parse_error(entry -> parse_error);
+        return;
+    }
+
+    // A line seen again is hot, so it gets compiled to machine code
+    long long start;
+    if (jit_enabled() && !entry -> jit_tried) {
+        entry -> jit_tried = 1;
+        start = start_timer();
+        compile_jit(&entry -> jit, &entry -> program);
+        stop_timer(TIME_COMPILE, start);
     }
-    return isstringdigit;
+
+    // The cache only holds lines run in the default context
+    context_t *ctx = &default_context;
+    start = start_timer();
+    int value = entry -> jit.code ? run_jit(&entry -> jit, &ctx -> vm, &ctx -> eval_error)
+                                  : run_program(&ctx -> vm, &entry -> program, &ctx -> eval_error);
+    stop_timer(TIME_EVAL, start);
+
+    if (ctx -> eval_error != EVAL_NONE){
+        report_eval_error(ctx -> eval_error);
+    }
+    else {
+        start = start_timer();
+        output_infix_result(context_out(ctx), entry -> infix, value);
+        stop_timer(TIME_PRINT, start);
+    }
+    ctx -> eval_error = EVAL_NONE;
 }
 
-void rep(char *exp) {
+/// ctx_rep, without the accounting for --alloc-stats
+///
+/// @param ctx The context
+/// @param exp The expression as a string
+static void rep_line(context_t *ctx, char *exp) {
+    FILE *err = context_err(ctx);
+    STAT_ADD(expressions, 1);
+
+    // The cache, the machine code and the formulas only know the
+    // default context's symbols
+    int shared = ctx == &default_context;
+
+    // A line seen before goes straight to evaluation
+    size_t key_len = 0;
+    int cacheable = shared && cache_enabled() && cache_key(exp, &key_len) == 0;
+    if (cacheable){
+        cache_entry_t *entry = find_cached(exp, key_len);
+        if (entry){
+            rep_cached(entry);
+            return;
+        }
+    }
+
     // First we build the parse tree
-    tree_node_t *tree = make_parse_tree(exp);
+    long long start = start_timer();
+    tree_node_t *tree = ctx_make_parse_tree(ctx, exp);
+    stop_timer(TIME_PARSE, start);
     // Make sure no errors occured in the construction of the parse tree
-    if (parse_error != PARSE_NONE){
-        switch(parse_error){  
-            case TOO_FEW_TOKENS:
-                fprintf(stderr, "Not enough tokens in expression!\n");
-                break;
-            case TOO_MANY_TOKENS:
-                fprintf(stderr, "Too many tokens in expression!\n");
-                break;
-            case INVALID_ASSIGNMENT: 
-                fprintf(stderr, "Assign to left hand side not a variable!\n");
-                break;
-            case ILLEGAL_TOKEN:
-                fprintf(stderr, "Illegal token is present!\n");
-                break;
-            default:
-                fprintf(stderr, "Unkown error occured!\n");
-                break;
+    if (ctx -> parse_error != PARSE_NONE){
+        write_parse_error(err, ctx -> parse_error);
+        if (cacheable){
+            add_cached(exp, key_len, ctx -> parse_error, NULL, NULL);
         }
+
         // Cleanup everything then reset the parse error back to NONE
-        if (tree != NULL){
-            cleanup_tree(tree);
-        }
-        parse_error = PARSE_NONE;
+        ctx_cleanup_tree(ctx, tree);
+        ctx -> parse_error = PARSE_NONE;
         return;
     }
     
-    // Now that there were no errors re evaluate the tree
-    int value = eval_tree(tree);
+    // Now that there were no errors simplify, compile and evaluate the
+    // tree, the tree walk is only needed if the program could not be
+    // allocated.  The tree itself is kept as written for printing.
+    int value;
+    start = start_timer();
+    program_t *program = &ctx -> program;
+    int compiled = compile_tree(program, optimize_tree(&ctx -> arena, tree)) == 0;
+    stop_timer(TIME_COMPILE, start);
+
+    if (compiled && cacheable){
+        add_cached(exp, key_len, PARSE_NONE, program, tree);
+    }
+    start = start_timer();
+    value = compiled ? ctx_run_program(ctx, &ctx -> vm, program, &ctx -> eval_error)
+                     : ctx_eval_tree(ctx, tree);
+    stop_timer(TIME_EVAL, start);
 
     // Check if there were any errors in the eval
-    if (eval_error != EVAL_NONE){
-        switch(eval_error) {
-            case DIVISION_BY_ZERO:
-                fprintf(stderr, "Division by zero\n");
-                break;
-            case INVALID_MODULUS:
-                fprintf(stderr, "Division by zero\n");
-                break;
-            case UNDEFINED_SYMBOL:
-                fprintf(stderr, "Symbol is not in the table!\n");
-                break;
-            case UNKNOWN_OPERATION:
-                fprintf(stderr, "Operation is unknown!\n");
-                break;
-            case UNKNOWN_EXP_TYPE:
-                fprintf(stderr, "Unknown expression type\n");            
-                break;        
-            case MISSING_LVALUE:
-                fprintf(stderr, "Missing a value on the left!\n");
-                break;
-            case INVALID_LVALUE:
-                fprintf(stderr, "Invalid value on the left\n");
-                break;
-            case SYMTAB_FULL:
-                fprintf(stderr, "Could not make symbol, symbol table is full!\n");
-                break;
-            default:
-                fprintf(stderr, "A unknown error occured!\n");
-                break;
-        }
+    if (ctx -> eval_error != EVAL_NONE){
+        write_eval_error(err, ctx -> eval_error);
     } 
     else {
-        // If no errors, we print
-        print_infix(tree);
-        printf(" = %d\n", value);
+        // If no errors, we print the whole line into the output buffer
+        start = start_timer();
+        output_result(context_out(ctx), tree, value);
+        stop_timer(TIME_PRINT, start);
+    }
+    // Reset the error value, then like a spreadsheet recompute whatever
+    // depends on the symbols this line assigned
+    ctx -> eval_error = EVAL_NONE;
+    if (compiled && shared && reactive_enabled()){
+        react(tree, program);
     }
-    // Reset the error value and cleanup the tree
-    eval_error = EVAL_NONE;
-    cleanup_tree(tree);
+    ctx_cleanup_tree(ctx, tree);
 }
 
-tree_node_t *parse(stack_t *stack) {
-    // We need to make a copy of the string, otherwise it will be freed
-    char *token, *dst = (char *) calloc(MAX_TOKEN, sizeof(char));
-    // Attempt to get the top of the stack
-    char *stack_val = (char *)top(stack);
+void ctx_rep(context_t *ctx, char *exp) {
+    alloc_stats_t before, after;
 
-    // Check the stack_val for not NULL
-    if (stack_val){
-        // Copy the value to the token
-        token = strcpy(dst, (char *)top(stack));
-    }
-    else {
-        // If the stack is empty that means there wasn't enough tokens
-        parse_error = TOO_FEW_TOKENS;
-        free(dst);
-        return NULL;
+    if (!alloc_per_line) {
+        rep_line(ctx, exp);
+        return;
     }
+    get_alloc_stats(&before);
+    rep_line(ctx, exp);
+    get_alloc_stats(&after);
+    print_alloc_change(stderr, &before, &after);
+}
 
-    // Remove it from the stack
-    pop(stack);
+void rep(char *exp) {
+    ctx_rep(&default_context, exp);
+}
 
-    // Check if it is a token by making sure it's not a digit or char
-    if (isalpha(*token) == 0 && isdigit(*token) == 0){
-        op_type_t op;
-        tree_node_t *left, *right;
-
-        // Check the operation based on the token
-        if (!strcmp(token, ADD_OP_STR)){
-            op = ADD_OP;
-            right = parse(stack);
-            left = parse(stack);
-        } 
-        else if (!strcmp(token, SUB_OP_STR)){
-            op = SUB_OP;
-            right = parse(stack);
-            left = parse(stack);
-        } 
-        else if (!strcmp(token, MUL_OP_STR)){
-            op = MUL_OP;
-            right = parse(stack);
-            left = parse(stack);
-        } 
-        else if (!strcmp(token, DIV_OP_STR)){
-            op = DIV_OP;
-            right = parse(stack);
-            left = parse(stack);
-        } 
-        else if (!strcmp(token, MOD_OP_STR)){
-            op = MOD_OP;
-            right = parse(stack);
-            left = parse(stack);
-        } 
-        else if (!strcmp(token, Q_OP_STR)){
-            op = Q_OP;
-            
-            // Get the left and right off of the : operator
-            tree_node_t *alt_right = parse(stack);
-            tree_node_t *alt_left = parse(stack);
-            
-            char *operand = calloc(sizeof(char), 2);
-            
-            // Set the operand as the :
-            operand[0] = ':';
-            
-            // Get both sides of the tree node
-            right = make_interior(ALT_OP, operand, alt_left, alt_right);
-            left = parse(stack);
-
-            return make_interior(op, token, left, right);
-        } 
-        else if (!strcmp(token, ASSIGN_OP_STR)){
-            op = ASSIGN_OP;
-            right = parse(stack);
-            left = parse(stack);
-
-            // We can't set a number on the left equal to something
-            if (isstringdigit(left -> token)){
-                parse_error = INVALID_ASSIGNMENT;
-                cleanup_tree(left);
-                cleanup_tree(right);
-                free(dst);
-                return NULL;
-            }
-        }
-        else {
-            // There was an illegal token present
-            parse_error = ILLEGAL_TOKEN;
-        }
+/// Reports running out of memory for a line's tree and exits
+static void out_of_memory(void) {
+    fprintf(stderr, "Could not allocate memory for the expression\n");
+    exit(EXIT_FAILURE);
+}
 
-        return make_interior(op, token, left, right);
+tree_node_t *ctx_make_parse_tree(context_t *ctx, char *expr) {
+    arena_t *arena = &ctx -> arena;
 
-    } 
-    else {
-        exp_type_t op;
-        if (isdigit(*token) != 0){
-            op = INTEGER;
-        } 
-        else {
-            op = SYMBOL;
-        }
-        return make_leaf(op, token);
-    }
-}
+    // Tokens are separated by a space, so there can be at most half as many
+    int max_tokens = (int)strlen(expr) / 2 + 1;
+    tree_node_t **operands = (tree_node_t **)arena_alloc(arena, sizeof(tree_node_t *) * max_tokens);
 
-tree_node_t *make_parse_tree(char *expr) {
-    // Make a stack to put the tokens in
-    stack_t *stack = make_stack();
+    // Marks every depth the operand stack reaches after the first token,
+    // counting the operands a short operator would have taken as negative.
+    // A token moves it at most 2 down or 1 up, so it stays in this range.
+    char *seen = (char *)arena_alloc(arena, 3 * max_tokens + 1);
+    if (operands == NULL || seen == NULL){
+        out_of_memory();
+    }
+    memset(seen, 0, 3 * max_tokens + 1);
+    seen += 2 * max_tokens;
 
-    int cur_index = 0;
+    int depth = 0, num_tokens = 0, underflow = 0, invalid = 0, illegal = 0;
 
-    char *data = (char *)calloc(MAX_TOKEN, sizeof(char));
+    lexer_t lexer;
+    token_t token;
+    init_lexer(&lexer, expr);
 
-    parse_tree_t state = READING;
+    while (next_token(&lexer, &token) != TOKEN_END){
+        if (token.kind == TOKEN_ILLEGAL){
+            ctx -> parse_error = ILLEGAL_TOKEN;
+            return NULL;
+        }
+        if (token.kind == TOKEN_COMMENT){
+            continue;
+        }
 
-    // Iterate through the expression and switch states accordingly
-    for (int i = 0; i < (int)(strlen(expr)); i++){
-        switch(state) {
-            case READING:
-                // if the data has a value and the expression element is a space
-                if (data[0] != '\0' && expr[i] == ' ') {
-                    state = READ;
-                }
-                else if (expr[i] == '#'){
-                    state = COMMENT;
-                    break;
-                }
-                else if (isoperand(expr[i]) == 0 && isalpha(expr[i]) == 0 && isdigit(expr[i]) == 0) {
-                    parse_error = ILLEGAL_TOKEN;
-                    state = ERROR;
-                    break;
+        // A number with letters after its digits is illegal at once at
+        // the end of the line.  Before a space it is illegal only if the
+        // line has no count or assignment error, which are reported
+        // instead, and before a comment it is just its leading digits.
+        if (token.kind == TOKEN_BAD_INTEGER){
+            char next = expr[token.offset + token.length];
+            if (next == '\0'){
+                ctx -> parse_error = ILLEGAL_TOKEN;
+                return NULL;
+            }
+            if (next == ' '){
+                illegal = 1;
+            }
+        }
+        if (num_tokens++ > 0){
+            seen[depth] = 1;
+        }
+        STAT_ADD(tokens, 1);
+
+        // Literals and symbols are the leaves of the tree.  A symbol that
+        // has been defined shares the interned copy of its name, but the
+        // line may name anything, so any other name stays in the arena
+        // and is only interned if a symbol or formula keeps it.
+        if (token.kind == TOKEN_SYMBOL){
+            if (!underflow){
+                char *name = lookup_interned(expr + token.offset, token.length);
+                if (name == NULL){
+                    name = arena_strndup(arena, expr + token.offset, token.length);
                 }
-                else if (expr[i] != ' ') {
-                    data[cur_index] = expr[i];
-                    cur_index++;
-                    break;
-                } 
-                else {
-                    break;
+                if (name == NULL || (operands[depth] = make_leaf(arena, SYMBOL, name, 0)) == NULL){
+                    out_of_memory();
                 }
-            case READ:
-                if(isstringdigit(data) == 0 && isdigit(data[0]) != 0){
-                    parse_error = ILLEGAL_TOKEN;
-                    state = ERROR;
-                } 
-                push(stack, (void *) data);
-                data = (char *)calloc(MAX_TOKEN, sizeof(char));
-                cur_index = 0;
-                if (expr[i] == '#'){
-                    state = COMMENT;
+            }
+            depth++;
+            continue;
+        }
+        if (token.kind != TOKEN_OPERATOR){
+            if (!underflow){
+                // A number that makes the line illegal is only a placeholder,
+                // as the tree is never used
+                if (token.kind == TOKEN_BAD_INTEGER && expr[token.offset + token.length] == ' '){
+                    operands[depth] = NULL;
                 }
                 else {
-                    state = READING;
+                    char *digits = arena_strndup(arena, expr + token.offset, token.length);
+                    if (digits == NULL ||
+                        (operands[depth] = make_leaf(arena, INTEGER, digits, token.value)) == NULL){
+                        out_of_memory();
+                    }
                 }
+            }
+            depth++;
+            continue;
+        }
+
+        // The ternary takes the condition and both alternatives
+        char op_char = expr[token.offset];
+        int arity = op_char == '?' ? 3 : 2;
+
+        // Once an operator comes up short the tree is never used, but
+        // the depth is still needed to tell which error to report
+        if (underflow || depth < arity){
+            underflow = 1;
+            depth += 1 - arity;
+            continue;
+        }
+
+        tree_node_t *right = operands[--depth];
+        tree_node_t *left = operands[--depth];
+        op_type_t op;
+
+        // Decide the operation from the single operator character
+        switch (op_char){
+            case '+':
+                op = ADD_OP;
                 break;
-            case COMMENT:
-                if (data[0] != '\0') {
-                    push(stack, (void *) data);
-                    data = (char *)calloc(MAX_TOKEN, sizeof(char));
-                }
-                if (expr[i] == '\n'){
-                    state = READING;
-                }
+            case '-':
+                op = SUB_OP;
+                break;
+            case '*':
+                op = MUL_OP;
+                break;
+            case '/':
+                op = DIV_OP;
                 break;
-            case ERROR:
-                if (data[0] != '\0'){
-                    push(stack, (void *) data);
+            case '%':
+                op = MOD_OP;
+                break;
+            case '=':
+                op = ASSIGN_OP;
+
+                // We can't set a number on the left equal to something
+                if (left && left -> type == LEAF && ((leaf_node_t *)left -> node) -> exp_type == INTEGER){
+                    invalid = 1;
                 }
-                else {
-                    free(data);
+                break;
+            default:
+                // Set the operand as the : between the two alternatives
+                op = Q_OP;
+                if ((right = make_interior(arena, ALT_OP, left, right)) == NULL){
+                    out_of_memory();
                 }
-                free_stack(stack);
-                return NULL;
+                left = operands[--depth];
                 break;
         }
+        if ((operands[depth++] = make_interior(arena, op, left, right)) == NULL){
+            out_of_memory();
+        }
     }
-    // Illegal token if the data is not a digit
-    if(isstringdigit(data) == 0 && isdigit(data[0]) != 0){
-        parse_error = ILLEGAL_TOKEN;
-        return NULL;
-    } 
 
-    if (data[0] != '\0'){
-        push(stack, (void *) data);
+    // Expressions are matched from the end of the line, so if some later
+    // token started a complete expression the ones before it are too many
+    if (depth - 1 >= -2 * max_tokens && seen[depth - 1]){
+        ctx -> parse_error = TOO_MANY_TOKENS;
+        return NULL;
     }
-    else {
-        free(data);
+    if (underflow || depth != 1){
+        ctx -> parse_error = TOO_FEW_TOKENS;
+        return NULL;
     }
-    // If we get here we can now parse the stack
-    tree_node_t *tree = parse(stack);
-
-    // if the stack isn't empty we will say that there were too many tokens
-    if (empty_stack(stack)){
-        free_stack(stack);
-        return tree;
+    if (invalid){
+        ctx -> parse_error = INVALID_ASSIGNMENT;
+        return NULL;
     }
-    else {
-        free_stack(stack);
-        parse_error = TOO_MANY_TOKENS;
-        cleanup_tree(tree);
+    if (illegal){
+        ctx -> parse_error = ILLEGAL_TOKEN;
         return NULL;
     }
+    return operands[0];
 }
 
-int eval_tree(tree_node_t *node) {
-    // Check to see if the type is a leaf or an interior
-    if (node -> type == LEAF) {
-        // We will return the value of the leaf if it exists
-        leaf_node_t *leaf = (leaf_node_t *)node -> node;
-
-        // We are missing a node to evaluate
-        if (leaf == NULL){
-            eval_error = MISSING_LVALUE;
-            return -1;
-        }
+tree_node_t *make_parse_tree(char *expr) {
+    return ctx_make_parse_tree(&default_context, expr);
+}
 
-        switch(leaf -> exp_type){
-            case INTEGER: {
-                return atoi(node -> token);
-            }
-            case SYMBOL:{
-                symbol_t *var_node = lookup_table(node -> token);
-                if (var_node == NULL){
-                    eval_error = UNDEFINED_SYMBOL;
-                    return -1;
-                }
-                return var_node -> val;
-            }
-            default: {
-                // This will be an unknown exp type
-                eval_error = UNKNOWN_EXP_TYPE;
-                return -1; 
+// Markers on the work stacks of the tree walks, only their addresses
+// matter.  ctx_eval_tree keeps each above the node it is for.
+static char second_marker, apply_marker, choose_marker, close_marker;
+#define SECOND ((void *)&second_marker) // the first operand is evaluated
+#define APPLY ((void *)&apply_marker)   // both operands are evaluated
+#define CHOOSE ((void *)&choose_marker) // the condition of a ? is evaluated
+#define CLOSE ((void *)&close_marker)   // the right side is written
+
+/// Evaluates a leaf, or a node that is neither a leaf nor interior
+///
+/// @param ctx The context whose symbols are used
+/// @param node The node
+/// @return Returns the value, or -1 with the context's eval_error set
+static int eval_leaf(context_t *ctx, tree_node_t *node) {
+    // We will return the value of the leaf if it exists
+    leaf_node_t *leaf = (leaf_node_t *)node -> node;
+
+    // We are missing a node to evaluate
+    if (node -> type != LEAF || leaf == NULL){
+        ctx -> eval_error = MISSING_LVALUE;
+        return -1;
+    }
+
+    switch(leaf -> exp_type){
+        case INTEGER: {
+            return leaf -> value;
+        }
+        case SYMBOL:{
+            symbol_t *var_node = ctx_lookup_table(ctx, node -> token);
+            if (var_node == NULL){
+                ctx -> eval_error = UNDEFINED_SYMBOL;
+                return -1;
             }
+            return ctx -> reader ? ctx_shared_value(ctx, var_node) : var_node -> val;
+        }
+        default: {
+            // This will be an unknown exp type
+            ctx -> eval_error = UNKNOWN_EXP_TYPE;
+            return -1; 
         }
     }
-    else if (node -> type == INTERIOR){
-        interior_node_t *interior = (interior_node_t *)node -> node;
-
-        // Get all the parts of the interior node
-        op_type_t op = interior -> op;
-
-        tree_node_t *left = interior -> left;
-        tree_node_t *right = interior -> right;
+}
 
-        int right_val = 0, left_val = 0;
-        // Check the operator to see what to perform on the symbols
-        switch(op){
-            case ADD_OP:{
-                return eval_tree(left) + eval_tree(right);
+/// Applies an interior node's operator to the values of its operands
+///
+/// @param ctx The context whose symbols are used
+/// @param node The interior node
+/// @param values The top of the value stack, holding the operands
+///     in the order they were evaluated
+/// @return Returns the number of values the operator used up
+static int apply_operator(context_t *ctx, tree_node_t *node, int *values) {
+    interior_node_t *interior = (interior_node_t *)node -> node;
+    tree_node_t *left = interior -> left;
+    int left_val, right_val;
+
+    switch(interior -> op){
+        case ADD_OP:
+            values[-2] = values[-2] + values[-1];
+            return 1;
+        case SUB_OP:
+            values[-2] = values[-2] - values[-1];
+            return 1;
+        case MUL_OP:
+            values[-2] = values[-2] * values[-1];
+            return 1;
+        case DIV_OP:
+            // The right side was evaluated first, so it is underneath
+            right_val = values[-2];
+            left_val = values[-1];
+
+            // Must check for divide by zero
+            if (right_val == 0){
+                ctx -> eval_error = DIVISION_BY_ZERO;
+                values[-2] = -1;
             }
-            case SUB_OP:{
-                return eval_tree(left) - eval_tree(right);
+            // INT_MIN / -1 traps, so -1 negates with wrap around instead
+            else if (right_val == -1){
+                values[-2] = (int)(0u - (unsigned int)left_val);
             }
-            case MUL_OP:{
-                return eval_tree(left) * eval_tree(right);
+            else {
+                values[-2] = left_val / right_val;
             }
-            case DIV_OP:{
-                // Must check for divide by zero
-                right_val = eval_tree(right);
-                left_val = eval_tree(left);
-
-                if (right_val == 0){
-                    eval_error = DIVISION_BY_ZERO;
-                    return -1;
-                }
-                else {
-                    return left_val / right_val;
-                }
+            return 1;
+        case MOD_OP:
+            right_val = values[-2];
+            left_val = values[-1];
+
+            // Must check for invalid mod
+            if (right_val == 0){
+                ctx -> eval_error = INVALID_MODULUS;
+                values[-2] = -1;
             }
-            case MOD_OP:{
-                // Must check for invalid mod
-                right_val = eval_tree(right);
-                left_val = eval_tree(left);
-
-                if (right_val == 0){
-                    eval_error = INVALID_MODULUS;
-                    return -1;
-                }
-                else {
-                    return left_val % right_val;
-                }
+            else if (right_val == -1){
+                values[-2] = 0;
             }
-            case ASSIGN_OP:{
-                // This will be an invalid Lvalue
-                if (left -> type != LEAF){
-                    eval_error = INVALID_LVALUE;             
-                }
-                char *left_val = calloc(strlen(left -> token) + 1, sizeof(char));
-
-                strcpy(left_val, left -> token);
-
-                int right_val = eval_tree(right);
+            else {
+                values[-2] = left_val % right_val;
+            }
+            return 1;
+        default: {
+            // Only an assignment is left, whose value is the right side's
+            symbol_t *sym = ctx_lookup_table(ctx, left -> token);
 
-                symbol_t *sym = lookup_table(left_val);
+            if (sym && ctx -> reader){
+                ctx_shared_assign(ctx, sym, values[-1]);
+            }
+            else if (sym){
+                sym -> val = values[-1];
+            }
+            // Could not allocate enough memory for this symbol
+            else if (ctx_create_symbol(ctx, left -> token, values[-1]) == NULL){
+                ctx -> eval_error = SYMTAB_FULL;
+            }
+            return 0;
+        }
+    }
+}
 
-                if (sym){
-                    sym -> val = right_val;
-                    free(left_val);
-                }
-                else {
-                    symbol_t *symbol = create_symbol(left_val, right_val);
-                    // Could not allocate enough memory for this symbol
-                    if (symbol == NULL){
-                        eval_error = SYMTAB_FULL;
+int ctx_eval_tree(context_t *ctx, tree_node_t *node) {
+    // The nodes being evaluated are on work, each under a marker for
+    // what is left to do, and the values so far are on the context's
+    // machine, so no depth of tree can run out of native stack
+    void *slots[STACK_LOCAL];
+    stack_t work;
+    vm_t *vm = &ctx -> vm;
+    int num_values = 0;
+
+    init_stack(&work, STACK_BORROWS, slots, STACK_LOCAL);
+    for (;;){
+        // Go down to the operand that is evaluated first
+        while (node -> type == INTERIOR){
+            interior_node_t *interior = (interior_node_t *)node -> node;
+            void *marker = SECOND;
+            tree_node_t *first = interior -> left;
+
+            switch(interior -> op){
+                case ADD_OP:
+                case SUB_OP:
+                case MUL_OP:
+                    break;
+                case DIV_OP:
+                case MOD_OP:
+                    // The right side is evaluated first for these
+                    first = interior -> right;
+                    break;
+                case ASSIGN_OP:
+                    // This will be an invalid Lvalue, but the
+                    // assignment still happens
+                    if (interior -> left -> type != LEAF){
+                        ctx -> eval_error = INVALID_LVALUE;
                     }
-                }
-                return right_val;
+                    marker = APPLY;
+                    first = interior -> right;
+                    break;
+                case Q_OP:
+                    marker = CHOOSE;
+                    break;
+                case ALT_OP:
+                case NO_OP:
+                default:
+                    // Both of the above and anything else should are not allowed
+                    ctx -> eval_error = UNKNOWN_OPERATION;
+                    marker = NULL;
+                    break;
             }
-            case Q_OP:{
-                // If we get not 0 for the left side, then we will call the left node's eval
-                if (eval_tree(left)){
-                    return eval_tree(((interior_node_t *)right -> node) -> left);
-                }
-                else {
-                    return eval_tree(((interior_node_t *)right -> node) -> right);
-                }
+            if (marker == NULL){
+                break;
             }
-            case ALT_OP:
-            case NO_OP:
-            default:
-                // Both of the above and anything else should are not allowed
-                eval_error = UNKNOWN_OPERATION;
-                return -1;                
+            push(&work, node);
+            push(&work, marker);
+            node = first;
+        }
+
+        if (num_values == vm -> size){
+            reserve_vm(vm, num_values ? num_values * 2 : STACK_LOCAL);
+        }
+        vm -> stack[num_values++] = node -> type == INTERIOR ? -1 : eval_leaf(ctx, node);
+
+        // Back up through the nodes that have all their operands
+        while (work.size > 0 && work.data[work.size - 1] == APPLY){
+            node = (tree_node_t *)work.data[work.size - 2];
+            work.size -= 2;
+            num_values -= apply_operator(ctx, node, vm -> stack + num_values);
+        }
+        if (work.size == 0){
+            break;
+        }
+
+        // then on to the next operand of the one that doesn't
+        void *marker = work.data[--work.size];
+        interior_node_t *interior = (interior_node_t *)((tree_node_t *)work.data[work.size - 1]) -> node;
+        if (marker == CHOOSE){
+            // If we get not 0 for the condition we evaluate the left
+            // side of the alternatives, otherwise the right
+            interior_node_t *alt = (interior_node_t *)interior -> right -> node;
+            work.size--;
+            node = vm -> stack[--num_values] ? alt -> left : alt -> right;
+        }
+        else {
+            work.data[work.size++] = APPLY;
+            node = interior -> op == DIV_OP || interior -> op == MOD_OP ? interior -> left
+                                                                       : interior -> right;
         }
     }
-    else {
-        // If the LVALUE is not either leaf or interior
-        eval_error = MISSING_LVALUE;
-        return -1;
-    }
+    release_stack(&work);
+    return vm -> stack[0];
+}
+
+int eval_tree(tree_node_t *node) {
+    return ctx_eval_tree(&default_context, node);
 }
 
 void print_infix(tree_node_t *node) {
-    if (node -> type == LEAF) {
-        printf("%s", node -> token);
-        return;
+    output_infix(standard_output(), node);
+}
+
+size_t infix_length(tree_node_t *node) {
+    void *slots[STACK_LOCAL];
+    stack_t work;
+    size_t len = 0;
+
+    // Down the left sides, with the right sides that aren't leaves
+    // left on work for later
+    init_stack(&work, STACK_BORROWS, slots, STACK_LOCAL);
+    for (;;){
+        while (node -> type == INTERIOR){
+            interior_node_t *interior = (interior_node_t  *)node -> node;
+
+            // The parentheses, the operator and the right side
+            len += 2 + strlen(op_spelling[interior -> op]);
+            if (interior -> right -> type == INTERIOR){
+                push(&work, interior -> right);
+            }
+            else {
+                len += strlen(interior -> right -> token);
+            }
+            node = interior -> left;
+        }
+        len += strlen(node -> token);
+        if (work.size == 0){
+            break;
+        }
+        node = (tree_node_t *)work.data[--work.size];
     }
+    release_stack(&work);
+    return len;
+}
+
+/// Copies a token to the text being written
+///
+/// @param token The token
+/// @param dst Where to write it
+/// @return Returns the end of what was written
+static char *copy_token(const char *token, char *dst) {
+    size_t len = strlen(token);
+
+    memcpy(dst, token, len);
+    return dst + len;
+}
+
+char *format_infix(tree_node_t *node, char *dst) {
+    void *slots[STACK_LOCAL];
+    stack_t work;
+
+    // The nodes whose left sides are being written are on work, and a
+    // CLOSE for each whose right side is
+    init_stack(&work, STACK_BORROWS, slots, STACK_LOCAL);
+    for (;;){
+        while (node -> type == INTERIOR){
+            *dst++ = '(';
+            push(&work, node);
+            node = ((interior_node_t  *)node -> node) -> left;
+        }
+        dst = copy_token(node -> token, dst);
 
-    if (node -> type == INTERIOR){
+        while (work.size > 0 && work.data[work.size - 1] == CLOSE){
+            work.size--;
+            *dst++ = ')';
+        }
+        if (work.size == 0){
+            break;
+        }
+
+        // The left side is done, so the operator then the right side,
+        // with the CLOSE taking the node's place
+        node = (tree_node_t *)work.data[work.size - 1];
+        work.data[work.size - 1] = CLOSE;
         interior_node_t *interior = (interior_node_t  *)node -> node;
-        printf("(");
-
-        // Print the left
-        print_infix(interior -> left);
-        
-        // Print the middle
-        printf("%s", node -> token);
-        
-        // Print the right
-        print_infix(interior -> right);
-        printf(")");
-    }  
+        dst = copy_token(op_spelling[interior -> op], dst);
+        node = interior -> right;
+    }
+    release_stack(&work);
+    return dst;
+}
+
+void ctx_cleanup_tree(context_t *ctx, tree_node_t *node) {
+    // Every node and token of the tree lives in the arena
+    (void)node;
+    arena_reset(&ctx -> arena);
 }
 
 void cleanup_tree(tree_node_t *node) {
-    // Recursively cleanup all of the elements in the tree
-    if (node){
-        switch(node -> type){
-            case INTERIOR: {
-                interior_node_t *interior = (interior_node_t *)node -> node;
-                cleanup_tree(interior -> right);
-                cleanup_tree(interior -> left);
-                free(interior);
-                break;
-            }
-            case LEAF: {
-                leaf_node_t *leaf = (leaf_node_t *)node -> node;
-                free(leaf);
-                break;
-            }
-        }   
-        free(node -> token);
-        free(node); 
-    }
-}
\ No newline at end of file
+    ctx_cleanup_tree(&default_context, node);
+}
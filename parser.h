@@ -4,7 +4,7 @@
 #define PARSER_H
 
 #include "tree_node.h"
-#include "stack.h"
+#include "lexer.h"
 
 /// The types of errors that can be run into while parsing
 /// or evaluating the tree
@@ -28,22 +28,31 @@ typedef enum eval_error_e {
     SYMTAB_FULL          //
 } eval_error_t;
 
+// The errors from the last parse and evaluation, and the arena every
+// tree built by make_parse_tree is allocated from, are those of the
+// default context (see context.h), as are the symbols.
+
 /// The main read-eval-print function that reads the expression,
 /// parses it, and evaluates the result, printing the infix expression
-/// and the resulting value to standard output.
+/// and the resulting value to standard output (see output.h).
 /// process, using the rest of the routines defined here.
 /// @param exp The expression as a string
 void rep(char *exp);
 
-/// Recursively build the parse tree from items on the stack
-/// @param stack  the list of tokens to parse
-/// @return the root of the parse tree, or NULL on failure
-/// @exception will occur if the parse fails
-tree_node_t *parse(stack_t *stack);
+/// Displays the message for a parse error to the default context's
+/// errors, standard error unless they were redirected
+/// @param error The error to report
+void report_parse_error(parse_error_t error);
+
+/// Displays the message for an evaluation error to the default
+/// context's errors, standard error unless they were redirected
+/// @param error The error to report
+void report_eval_error(eval_error_t error);
 
-/// Constructs the expression tree from the expression.  It
-/// must use the stack to order the tokens.  It must also
-/// deallocate the memory associated with the stack in all cases.
+/// Constructs the expression tree from the expression in a single
+/// left to right pass, keeping the operands on an array stack.  The
+/// tokens and every node of the tree are allocated from the
+/// parse arena, which cleanup_tree releases in one step.
 /// If a symbol is encountered, it should be stored in the node
 /// without checking if it is in the symbol table - evaluation will
 /// resolve that issue.
@@ -59,11 +68,16 @@ tree_node_t *parse(stack_t *stack);
 ///
 ///     Invalid expression, not enough tokens
 ///
-///     2. If there are many tokens (stack is not empty after building),
+///     2. If there are many tokens (tokens are left before the last
+///     complete expression on the line),
 ///     set the parser error to TOO_MANY_TOKENS and display the message
 ///     to standard error:
 ///
 ///     Invalid expression, too many tokens
+///
+///     If the arena can't grow to hold the tree, an error message is
+///     displayed to standard error and the program exits with
+///     EXIT_FAILURE
 tree_node_t *make_parse_tree(char *expr);
 
 /// Evaluates the tree and returns the result.
@@ -72,6 +86,9 @@ tree_node_t *make_parse_tree(char *expr);
 ///     is a parser error.
 /// @return the evaluated int.  Note:  A symbol evaluates
 ///     to the value bound to it.
+/// The walk keeps its place on an explicit stack, as print_infix,
+/// infix_length and format_infix do, so trees of any depth can be
+/// evaluated without running out of native stack.
 int eval_tree(tree_node_t * node);
 
 /// Displays the infix expression for the tree, using
@@ -80,13 +97,28 @@ int eval_tree(tree_node_t * node);
 /// postfix expression: 10 20 + 30 *
 /// infix string: ((10+20)*30) 
 ///
+/// The text goes to the standard_output buffer, not stdio.
 /// @param node  the tree_node of the tree to print
 /// @precondition:  This routine should not be called if there
 ///     is a parser error.
 void print_infix(tree_node_t * node);
 
+/// Counts the characters print_infix would display for the tree
+/// @param node  the root of the tree
+/// @return the length of the infix string
+size_t infix_length(tree_node_t * node);
+
+/// Writes the same text as print_infix into a buffer, without
+/// a null terminator
+/// @param node  the root of the tree
+/// @param dst  where to write, at least infix_length(node) characters
+/// @return the character after the last one written
+char *format_infix(tree_node_t * node, char *dst);
+
 /// Cleans up all dynamic memory associated with the expression tree.
-/// @param node The current node in the tree
+/// Trees live in the parse arena, so this resets it in O(1) and also
+/// releases any other tree built since the last cleanup.
+/// @param node The root of the tree (may be NULL)
 void cleanup_tree(tree_node_t * node);
 
 #endif
@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "reactive.h"
+#include "alloc.h"
+#include "parser.h"
+#include "context.h"
+#include "intern.h"
+#include "optimize.h"
+#include "output.h"
+#include "stack.h"
+#include "symtab.h"
+
+#define MIN_CELLS 64
+
+/// A symbol in the dependency graph: one that has a formula, or that
+/// some formula reads
+typedef struct cell_s {
+    char *name;                 ///< the symbol (interned)
+    unsigned int hash;          ///< the hash of name
+    int has_formula;            ///< whether the fields below are set
+    program_t program;          ///< the formula
+    char *infix;                ///< what the line that defined it prints
+    struct cell_s **reads;      ///< the cells the formula reads, each once
+    int num_reads;
+    struct cell_s **readers;    ///< the cells whose formulas read this one
+    int num_readers;
+    int readers_size;           ///< the number of readers allocated
+    unsigned long seen;         ///< the last traversal that reached this cell
+    int waiting;                ///< reads still to be recomputed
+    struct cell_s *chain;       ///< the next cell in the same bucket
+} cell_t;
+
+static int reactive_on;
+static cell_t **cells;          // chained hash of cells by name
+static size_t num_buckets;
+static size_t num_cells;
+static unsigned long traversal; // bumped for every walk over the graph
+static program_t scratch;       // formulas are compiled here first
+static vm_t vm;
+
+void enable_reactive(void) {
+    reactive_on = 1;
+}
+
+int reactive_enabled(void) {
+    return reactive_on;
+}
+
+/// Reports running out of memory and exits
+static void out_of_memory(void) {
+    fprintf(stderr, "Could not allocate memory for the formulas\n");
+    exit(EXIT_FAILURE);
+}
+
+/// Finds the cell for a symbol, making it if needed
+///
+/// @param name The symbol
+/// @return Returns the cell
+static cell_t *find_cell(const char *name) {
+    unsigned int hash = hash_name(name);
+
+    if (num_buckets) {
+        for (cell_t *cell = cells[hash & (num_buckets - 1)]; cell; cell = cell -> chain) {
+            if (cell -> hash == hash && !strcmp(cell -> name, name)) {
+                return cell;
+            }
+        }
+    }
+
+    // Keep about one cell a bucket
+    if (num_cells + 1 > num_buckets) {
+        size_t size = num_buckets ? num_buckets * 2 : MIN_CELLS;
+        cell_t **bigger = (cell_t **)tracked_calloc(size, sizeof(cell_t *));
+        if (bigger == NULL) {
+            out_of_memory();
+        }
+        for (size_t i = 0; i < num_buckets; i++) {
+            while (cells[i]) {
+                cell_t *cell = cells[i];
+                cells[i] = cell -> chain;
+                cell -> chain = bigger[cell -> hash & (size - 1)];
+                bigger[cell -> hash & (size - 1)] = cell;
+            }
+        }
+        tracked_free(cells);
+        cells = bigger;
+        num_buckets = size;
+    }
+
+    cell_t *cell = (cell_t *)tracked_calloc(1, sizeof(cell_t));
+    if (cell == NULL || (cell -> name = intern(name, strlen(name))) == NULL) {
+        out_of_memory();
+    }
+    cell -> hash = hash;
+    init_program(&cell -> program);
+    cell -> chain = cells[hash & (num_buckets - 1)];
+    cells[hash & (num_buckets - 1)] = cell;
+    num_cells++;
+    return cell;
+}
+
+/// Removes a cell's formula, and it from the readers of what it read
+///
+/// @param cell The cell to clear
+static void clear_formula(cell_t *cell) {
+    if (!cell -> has_formula) {
+        return;
+    }
+    for (int i = 0; i < cell -> num_reads; i++) {
+        cell_t *read = cell -> reads[i];
+        for (int j = 0; j < read -> num_readers; j++) {
+            if (read -> readers[j] == cell) {
+                read -> readers[j] = read -> readers[--read -> num_readers];
+                break;
+            }
+        }
+    }
+    tracked_free(cell -> reads);
+    tracked_free(cell -> infix);
+    free_program(&cell -> program);
+    cell -> reads = NULL;
+    cell -> num_reads = 0;
+    cell -> infix = NULL;
+    cell -> has_formula = 0;
+}
+
+/// Tells whether a formula reading the cells on a stack would
+/// depend on a cell, through the formulas of what it reads
+///
+/// @param cell The cell the formula would be for
+/// @param work The cells the formula reads (emptied)
+/// @return Returns true if the formula would depend on cell
+static int depends_on(cell_t *cell, stack_t *work) {
+    int found = 0;
+
+    traversal++;
+    while (!empty_stack(work)) {
+        cell_t *cur = (cell_t *)top(work);
+        pop(work);
+        if (cur == cell) {
+            found = 1;
+        }
+        if (found || cur -> seen == traversal) {
+            continue;
+        }
+        cur -> seen = traversal;
+        for (int i = 0; i < cur -> num_reads; i++) {
+            push(work, cur -> reads[i]);
+        }
+    }
+    return found;
+}
+
+/// Makes the right side of an assignment the formula for a cell
+///
+/// @param cell The cell being assigned
+/// @param tree The whole line, for printing
+/// @param value The right side of the assignment
+/// @param work An empty stack to use
+static void define_formula(cell_t *cell, tree_node_t *tree, tree_node_t *value, stack_t *work) {
+    if (compile_tree(&scratch, optimize_tree(&default_context.arena, value)) != 0) {
+        out_of_memory();
+    }
+
+    // Formulas that assign as they are evaluated aren't kept
+    for (int i = 0; i < scratch.length; i++) {
+        if (scratch.code[i].op == OP_STORE) {
+            clear_formula(cell);
+            return;
+        }
+    }
+    for (int i = 0; i < scratch.length; i++) {
+        if (scratch.code[i].name) {
+            push(work, find_cell(scratch.code[i].name));
+        }
+    }
+    if (depends_on(cell, work)) {
+        fprintf(context_err(&default_context), "The formula for %s depends on itself, so it is not kept\n", cell -> name);
+        clear_formula(cell);
+        return;
+    }
+    clear_formula(cell);
+
+    // Copy the program.  Its names are still in the line's arena, so
+    // each becomes the interned name of the cell it reads below.
+    cell -> infix = (char *)tracked_malloc(infix_length(tree) + 1);
+    cell -> program.code = (instr_t *)tracked_malloc(sizeof(instr_t) * scratch.length);
+    cell -> reads = (cell_t **)tracked_malloc(sizeof(cell_t *) * scratch.length);
+    if (cell -> infix == NULL || cell -> program.code == NULL || cell -> reads == NULL) {
+        out_of_memory();
+    }
+    *format_infix(tree, cell -> infix) = '\0';
+    memcpy(cell -> program.code, scratch.code, sizeof(instr_t) * scratch.length);
+    cell -> program.length = scratch.length;
+    cell -> program.capacity = scratch.length;
+    cell -> program.max_depth = scratch.max_depth;
+    cell -> program.version = scratch.version;
+
+    traversal++;
+    for (int i = 0; i < scratch.length; i++) {
+        instr_t *instr = &cell -> program.code[i];
+        if (instr -> name == NULL) {
+            continue;
+        }
+
+        // Each cell is read once however often the formula names it
+        cell_t *read = find_cell(instr -> name);
+        instr -> name = read -> name;
+        if (read -> seen == traversal) {
+            continue;
+        }
+        read -> seen = traversal;
+        cell -> reads[cell -> num_reads++] = read;
+        if (read -> num_readers == read -> readers_size) {
+            read -> readers_size = read -> readers_size ? read -> readers_size * 2 : 4;
+            read -> readers = (cell_t **)tracked_realloc(read -> readers, sizeof(cell_t *) * read -> readers_size);
+            if (read -> readers == NULL) {
+                out_of_memory();
+            }
+        }
+        read -> readers[read -> num_readers++] = cell;
+    }
+    cell -> has_formula = 1;
+}
+
+/// Evaluates a formula again and assigns the result
+///
+/// @param cell The cell to recompute
+static void recompute(cell_t *cell) {
+    eval_error_t error;
+    int value = run_program(&vm, &cell -> program, &error);
+
+    // As with =, the value is assigned even if there was an error
+    symbol_t *sym = lookup_table(cell -> name);
+    if (sym) {
+        sym -> val = value;
+    }
+    else if (create_symbol(cell -> name, value) == NULL) {
+        error = SYMTAB_FULL;
+    }
+
+    if (error != EVAL_NONE) {
+        report_eval_error(error);
+    }
+    else {
+        output_infix_result(context_out(&default_context), cell -> infix, value);
+    }
+}
+
+/// Recomputes every formula that depends on the changed cells, each
+/// after everything it reads
+///
+/// @param changed The cells that were assigned (emptied)
+/// @param work An empty stack to use
+static void propagate(stack_t *changed, stack_t *work) {
+    stack_t *affected = make_stack_owned_by(STACK_BORROWS);
+
+    // Find everything downstream of the changes
+    traversal++;
+    while (!empty_stack(changed)) {
+        cell_t *cell = (cell_t *)top(changed);
+        pop(changed);
+        for (int i = 0; i < cell -> num_readers; i++) {
+            cell_t *reader = cell -> readers[i];
+            if (reader -> seen != traversal) {
+                reader -> seen = traversal;
+                push(affected, reader);
+                push(changed, reader);
+            }
+        }
+    }
+
+    // A formula is ready once none of what it reads is waiting
+    for (int i = 0; i < affected -> size; i++) {
+        cell_t *cell = (cell_t *)affected -> data[i];
+        cell -> waiting = 0;
+        for (int j = 0; j < cell -> num_reads; j++) {
+            cell -> waiting += cell -> reads[j] -> seen == traversal;
+        }
+        if (cell -> waiting == 0) {
+            push(work, cell);
+        }
+    }
+
+    int done = 0;
+    while (!empty_stack(work)) {
+        cell_t *cell = (cell_t *)top(work);
+        pop(work);
+        recompute(cell);
+        done++;
+        for (int i = 0; i < cell -> num_readers; i++) {
+            cell_t *reader = cell -> readers[i];
+            if (reader -> seen == traversal && --reader -> waiting == 0) {
+                push(work, reader);
+            }
+        }
+    }
+
+    // Anything left is on a cycle, which define_formula should prevent
+    if (done < affected -> size) {
+        FILE *err = context_err(&default_context);
+        fprintf(err, "Formulas depend on each other in a cycle:");
+        for (int i = 0; i < affected -> size; i++) {
+            cell_t *cell = (cell_t *)affected -> data[i];
+            if (cell -> waiting > 0) {
+                fprintf(err, " %s", cell -> name);
+            }
+        }
+        fprintf(err, "\n");
+    }
+    free_stack(affected);
+}
+
+void react(tree_node_t *tree, program_t *prog) {
+    stack_t *changed = make_stack_owned_by(STACK_BORROWS);
+    stack_t *work = make_stack_owned_by(STACK_BORROWS);
+
+    // Only "name expression =" defines a formula
+    if (tree -> type == INTERIOR) {
+        interior_node_t *interior = (interior_node_t *)tree -> node;
+        tree_node_t *left = interior -> left;
+        if (interior -> op == ASSIGN_OP && left -> type == LEAF &&
+            ((leaf_node_t *)left -> node) -> exp_type == SYMBOL) {
+            define_formula(find_cell(left -> token), tree, interior -> right, work);
+        }
+    }
+
+    // Everything the line assigned has changed, the formulas that read
+    // them are the only ones that need evaluating again
+    for (int i = 0; i < prog -> length; i++) {
+        if (prog -> code[i].op == OP_STORE) {
+            push(changed, find_cell(prog -> code[i].name));
+        }
+    }
+    propagate(changed, work);
+
+    free_stack(work);
+    free_stack(changed);
+}
+
+void free_reactive(void) {
+    for (size_t i = 0; i < num_buckets; i++) {
+        while (cells[i]) {
+            cell_t *cell = cells[i];
+            cells[i] = cell -> chain;
+            tracked_free(cell -> reads);
+            tracked_free(cell -> infix);
+            free_program(&cell -> program);
+            tracked_free(cell -> readers);
+            tracked_free(cell);
+        }
+    }
+    tracked_free(cells);
+    cells = NULL;
+    num_buckets = 0;
+    num_cells = 0;
+    free_program(&scratch);
+    free_vm(&vm);
+    reactive_on = 0;
+}
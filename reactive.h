@@ -0,0 +1,32 @@
+// Spreadsheet style recomputation of the symbols that depend on others
+
+#ifndef REACTIVE_H
+#define REACTIVE_H
+
+#include "bytecode.h"
+
+/// Turns on reactive mode.  A line of the form "name expression ="
+/// then also records expression as the formula for name, and whenever
+/// a line assigns a symbol, every formula that depends on it (directly
+/// or through other formulas) is evaluated again in dependency order,
+/// printing what the line that defined it would print.  Only those
+/// formulas are evaluated, so an update costs what it changes rather
+/// than the length of the script.
+void enable_reactive(void);
+
+/// Tells whether reactive mode is on
+/// @return true if enable_reactive was called
+int reactive_enabled(void);
+
+/// Records the formula a line defines, if any, and recomputes what
+/// depends on the symbols it assigned.  A formula that would depend
+/// on itself, or that assigns other symbols as it is evaluated, is
+/// not kept, and the symbol it assigns stops having a formula.
+/// @param tree The line, which has been evaluated
+/// @param prog The line compiled, to find what it assigned
+void react(tree_node_t *tree, program_t *prog);
+
+/// Forgets every formula
+void free_reactive(void);
+
+#endif
@@ -0,0 +1,484 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "script.h"
+#include "alloc.h"
+#include "bytecode.h"
+#include "context.h"
+#include "optimize.h"
+#include "output.h"
+#include "parser.h"
+#include "stats.h"
+#include "symtab.h"
+
+#define SCRIPT_MAGIC "SCRIPT\n"
+#define SCRIPT_VERSION 1
+#define MIN_ARRAY 64            // elements allocated when an array first grows
+
+/// The start of a compiled script.  It is followed by the lines, then
+/// the instructions of all of them, then the string pool.
+typedef struct script_header_s {
+    char magic[8];              ///< SCRIPT_MAGIC
+    unsigned int version;       ///< SCRIPT_VERSION
+    unsigned int lines;         ///< the number of script_line_t
+    unsigned int instrs;        ///< the number of script_instr_t
+    unsigned int pool_size;     ///< bytes of names and infix text
+} script_header_t;
+
+/// A line of a compiled script
+typedef struct script_line_s {
+    unsigned int code;          ///< the index of its first instruction
+    unsigned int length;        ///< the number of instructions (0 if it didn't parse)
+    unsigned int infix;         ///< the offset in the pool of what it prints
+    int parse_error;            ///< the parse_error_t, or PARSE_NONE
+} script_line_t;
+
+/// An instruction of a compiled script.  Jumps are to indexes in the
+/// line's own program, as in program_t, and the symbol of an OP_LOAD or
+/// OP_STORE is in its arg as an offset in the pool.
+typedef struct script_instr_s {
+    int op;                     ///< the opcode_t
+    int arg;                    ///< the immediate, jump target, error or symbol
+} script_instr_t;
+
+/// A compiled script being put together in memory
+typedef struct builder_s {
+    script_line_t *lines;
+    size_t num_lines;
+    size_t lines_size;          ///< the number of lines allocated
+    script_instr_t *code;
+    size_t num_instrs;
+    size_t code_size;           ///< the number of instructions allocated
+    char *pool;
+    size_t pool_len;
+    size_t pool_size;           ///< the number of bytes allocated for pool
+    unsigned int *names;        ///< the names in the pool by hash, as offset + 1 (0 is empty)
+    size_t num_names;
+    size_t names_size;          ///< the number of slots, a power of two
+} builder_t;
+
+/// Reports running out of memory and exits
+static void out_of_memory(void) {
+    fprintf(stderr, "Could not allocate memory for the compiled script\n");
+    exit(EXIT_FAILURE);
+}
+
+/// Makes room in an array that grows by doubling
+///
+/// @param array The array
+/// @param size The number of elements allocated, updated if it grows
+/// @param needed The number of elements needed
+/// @param elem The size of an element
+/// @return Returns the array, which may have moved
+static void *reserve_array(void *array, size_t *size, size_t needed, size_t elem) {
+    if (needed <= *size) {
+        return array;
+    }
+    size_t bigger = *size ? *size : MIN_ARRAY;
+    while (bigger < needed) {
+        bigger *= 2;
+    }
+    array = tracked_realloc(array, bigger * elem);
+    if (array == NULL) {
+        out_of_memory();
+    }
+    *size = bigger;
+    return array;
+}
+
+/// Finds a name in the pool, adding it the first time it is seen, so
+/// every symbol is stored once however many lines name it
+///
+/// @param builder The script
+/// @param name The symbol
+/// @return Returns the offset of the name in the pool
+static unsigned int intern_name(builder_t *builder, const char *name) {
+    // Keep the index at most half full
+    if ((builder -> num_names + 1) * 2 > builder -> names_size) {
+        size_t size = builder -> names_size ? builder -> names_size * 2 : MIN_ARRAY;
+        unsigned int *names = (unsigned int *)tracked_calloc(size, sizeof(unsigned int));
+        if (names == NULL) {
+            out_of_memory();
+        }
+        for (size_t i = 0; i < builder -> names_size; i++) {
+            unsigned int entry = builder -> names[i];
+            if (entry) {
+                size_t slot = hash_name(builder -> pool + entry - 1) & (size - 1);
+                while (names[slot]) {
+                    slot = (slot + 1) & (size - 1);
+                }
+                names[slot] = entry;
+            }
+        }
+        tracked_free(builder -> names);
+        builder -> names = names;
+        builder -> names_size = size;
+    }
+
+    size_t mask = builder -> names_size - 1, slot = hash_name(name) & mask;
+    while (builder -> names[slot]) {
+        unsigned int offset = builder -> names[slot] - 1;
+        if (!strcmp(builder -> pool + offset, name)) {
+            return offset;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    size_t len = strlen(name) + 1, offset = builder -> pool_len;
+    builder -> pool = (char *)reserve_array(builder -> pool, &builder -> pool_size,
+                                            offset + len, 1);
+    memcpy(builder -> pool + offset, name, len);
+    builder -> pool_len += len;
+    builder -> names[slot] = offset + 1;
+    builder -> num_names++;
+    return offset;
+}
+
+/// Parses and compiles a line of the script onto the end of it
+///
+/// @param builder The script
+/// @param text The line
+static void add_line(builder_t *builder, char *text) {
+    builder -> lines = (script_line_t *)reserve_array(builder -> lines, &builder -> lines_size,
+                                                      builder -> num_lines + 1, sizeof(script_line_t));
+    script_line_t *line = &builder -> lines[builder -> num_lines++];
+    memset(line, 0, sizeof(*line));
+
+    // A line that doesn't parse is kept, to report when it is run
+    tree_node_t *tree = make_parse_tree(text);
+    if (default_context.parse_error != PARSE_NONE) {
+        line -> parse_error = default_context.parse_error;
+        default_context.parse_error = PARSE_NONE;
+        cleanup_tree(tree);
+        return;
+    }
+
+    // The same program rep would run, and the text it would print
+    program_t *prog = &default_context.program;
+    if (compile_tree(prog, optimize_tree(&default_context.arena, tree)) != 0) {
+        out_of_memory();
+    }
+    builder -> code = (script_instr_t *)reserve_array(builder -> code, &builder -> code_size,
+                                                      builder -> num_instrs + prog -> length,
+                                                      sizeof(script_instr_t));
+    line -> code = builder -> num_instrs;
+    line -> length = prog -> length;
+    for (int i = 0; i < prog -> length; i++) {
+        script_instr_t *instr = &builder -> code[builder -> num_instrs++];
+        instr -> op = prog -> code[i].op;
+        instr -> arg = prog -> code[i].name ? (int)intern_name(builder, prog -> code[i].name)
+                                            : prog -> code[i].arg;
+    }
+
+    size_t len = infix_length(tree);
+    builder -> pool = (char *)reserve_array(builder -> pool, &builder -> pool_size,
+                                            builder -> pool_len + len + 1, 1);
+    line -> infix = builder -> pool_len;
+    *format_infix(tree, builder -> pool + builder -> pool_len) = '\0';
+    builder -> pool_len += len + 1;
+    cleanup_tree(tree);
+
+    // Offsets in the pool have to fit in an instruction's arg
+    if (builder -> num_instrs >= UINT_MAX || builder -> pool_len >= INT_MAX) {
+        fprintf(stderr, "The script is too big to compile\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/// Reads a whole file into memory
+///
+/// @param filename The file
+/// @param len Set to the number of bytes read
+/// @return Returns the text, with room for a null terminator after it
+static char *read_file(char *filename, size_t *len) {
+    FILE *fp = fopen(filename, "r");
+    size_t size = 0, used = 0, got;
+    char *text = NULL;
+
+    if (fp == NULL) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    do {
+        text = (char *)reserve_array(text, &size, used + BUFSIZ + 1, 1);
+        got = fread(text + used, 1, size - used - 1, fp);
+        used += got;
+    } while (got > 0);
+    if (ferror(fp)) {
+        fprintf(stderr, "Error reading %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    fclose(fp);
+    *len = used;
+    return text;
+}
+
+void compile_script(char *script, char *filename) {
+    builder_t builder;
+    size_t len;
+    char *text = read_file(script, &len);
+
+    // Lines are split the way batch mode splits them
+    memset(&builder, 0, sizeof(builder));
+    char *line = text, *end = text + len, *newline;
+    while ((newline = memchr(line, '\n', end - line)) != NULL) {
+        *newline = '\0';
+        add_line(&builder, line);
+        line = newline + 1;
+    }
+    if (line < end) {
+        *end = '\0';
+        add_line(&builder, line);
+    }
+    if (builder.num_lines >= UINT_MAX) {
+        fprintf(stderr, "The script is too big to compile\n");
+        exit(EXIT_FAILURE);
+    }
+
+    script_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCRIPT_MAGIC, sizeof(header.magic));
+    header.version = SCRIPT_VERSION;
+    header.lines = builder.num_lines;
+    header.instrs = builder.num_instrs;
+    header.pool_size = builder.pool_len;
+
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(builder.lines, sizeof(script_line_t), builder.num_lines, fp);
+    fwrite(builder.code, sizeof(script_instr_t), builder.num_instrs, fp);
+    fwrite(builder.pool, 1, builder.pool_len, fp);
+    int failed = ferror(fp);
+    if (fclose(fp) != 0 || failed) {
+        fprintf(stderr, "Error writing %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    tracked_free(builder.names);
+    tracked_free(builder.pool);
+    tracked_free(builder.code);
+    tracked_free(builder.lines);
+    tracked_free(text);
+}
+
+/// Reports a file that can't be run and exits
+///
+/// @param filename The file
+static void bad_script(char *filename) {
+    fprintf(stderr, "%s is not a compiled script\n", filename);
+    exit(EXIT_FAILURE);
+}
+
+/// Checks that a line's program can't leave its code or its value
+/// stack whatever it is given, as compile_tree's programs can't.
+/// Jumps only go forward, so each instruction runs at most once and
+/// the depth at each one is known before it is reached.
+///
+/// @param line The line
+/// @param code The instructions of the script
+/// @param pool_size The bytes in the pool, which ends with a null
+/// @param depth Space for the depth before each instruction
+/// @return Returns the deepest the value stack gets, or -1 if the
+///     program could go wrong
+static int check_line(script_line_t *line, script_instr_t *code, size_t pool_size, int *depth) {
+    if (line -> parse_error != PARSE_NONE) {
+        return line -> parse_error > PARSE_NONE && line -> parse_error < NUM_PARSE_ERRORS &&
+               line -> length == 0 ? 0 : -1;
+    }
+    if (line -> length == 0 || line -> length > INT_MAX || line -> infix >= pool_size) {
+        return -1;
+    }
+
+    int length = line -> length, max_depth = 0;
+    code += line -> code;
+    for (int i = 0; i < length; i++) {
+        depth[i] = -1;
+    }
+    depth[0] = 0;
+    for (int i = 0; i < length; i++) {
+        int needs = 0, change = 0, falls = 1, jumps = 0, named = 0;
+
+        switch (code[i].op) {
+            case OP_PUSH:
+                change = 1;
+                break;
+            case OP_LOAD:
+                change = named = 1;
+                break;
+            case OP_STORE:
+                needs = named = 1;
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_MOD:
+                needs = 2;
+                change = -1;
+                break;
+            case OP_JUMP_ZERO:
+                needs = jumps = 1;
+                change = -1;
+                break;
+            case OP_JUMP:
+                jumps = 1;
+                falls = 0;
+                break;
+            case OP_ERROR:
+                if (code[i].arg <= EVAL_NONE || code[i].arg >= NUM_EVAL_ERRORS) {
+                    return -1;
+                }
+                break;
+            case OP_HALT:
+                needs = 1;
+                falls = 0;
+                break;
+            default:
+                return -1;
+        }
+
+        // Every instruction is reached, and with enough on the stack
+        int d = depth[i];
+        if (d < needs || (named && (code[i].arg < 0 || (size_t)code[i].arg >= pool_size))) {
+            return -1;
+        }
+        d += change;
+        if (d > max_depth) {
+            max_depth = d;
+        }
+
+        // Whichever way an instruction is reached, the depth is the same
+        if (jumps) {
+            int target = code[i].arg;
+            if (target <= i || target >= length || (depth[target] >= 0 && depth[target] != d)) {
+                return -1;
+            }
+            depth[target] = d;
+        }
+        if (falls) {
+            if (i + 1 == length || (depth[i + 1] >= 0 && depth[i + 1] != d)) {
+                return -1;
+            }
+            depth[i + 1] = d;
+        }
+    }
+    return max_depth;
+}
+
+void run_script(char *filename) {
+    int fd = open(filename, O_RDONLY);
+    struct stat info;
+
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)info.st_size < sizeof(script_header_t)) {
+        bad_script(filename);
+    }
+    char *data = (char *)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+
+    // Check everything fits before trusting any of it
+    script_header_t *header = (script_header_t *)data;
+    size_t num_lines = header -> lines, num_instrs = header -> instrs;
+    size_t pool_size = header -> pool_size;
+    size_t expected = sizeof(script_header_t) + num_lines * sizeof(script_line_t)
+                    + num_instrs * sizeof(script_instr_t) + pool_size;
+    if (memcmp(header -> magic, SCRIPT_MAGIC, sizeof(header -> magic)) ||
+        header -> version != SCRIPT_VERSION || expected != (size_t)info.st_size ||
+        (pool_size && data[info.st_size - 1] != '\0')) {
+        bad_script(filename);
+    }
+    script_line_t *lines = (script_line_t *)(header + 1);
+    script_instr_t *code = (script_instr_t *)(lines + num_lines);
+    char *pool = (char *)(code + num_instrs);
+
+    size_t longest = 0;
+    for (size_t i = 0; i < num_lines; i++) {
+        if (lines[i].code > num_instrs || lines[i].length > num_instrs - lines[i].code) {
+            bad_script(filename);
+        }
+        if (lines[i].length > longest) {
+            longest = lines[i].length;
+        }
+    }
+    int *depth = (int *)tracked_malloc(sizeof(int) * (longest + 1));
+    if (depth == NULL) {
+        out_of_memory();
+    }
+    int max_depth = 0;
+    for (size_t i = 0; i < num_lines; i++) {
+        int line_depth = check_line(&lines[i], code, pool_size, depth);
+        if (line_depth < 0) {
+            bad_script(filename);
+        }
+        if (line_depth > max_depth) {
+            max_depth = line_depth;
+        }
+    }
+    tracked_free(depth);
+
+    // Each line is unpacked into the one program, with its names
+    // pointing into the pool, and run as rep would run it
+    context_t *ctx = &default_context;
+    program_t prog;
+    init_program(&prog);
+    prog.code = (instr_t *)tracked_malloc(sizeof(instr_t) * (longest + 1));
+    if (prog.code == NULL) {
+        out_of_memory();
+    }
+    prog.capacity = longest;
+    prog.max_depth = max_depth;
+    for (size_t i = 0; i < num_lines; i++) {
+        script_line_t *line = &lines[i];
+        STAT_ADD(expressions, 1);
+
+        if (line -> parse_error != PARSE_NONE) {
+            report_parse_error((parse_error_t)line -> parse_error);
+            poll_stats(stderr);
+            continue;
+        }
+        for (unsigned int j = 0; j < line -> length; j++) {
+            script_instr_t *instr = &code[line -> code + j];
+            int named = instr -> op == OP_LOAD || instr -> op == OP_STORE;
+            prog.code[j].op = (opcode_t)instr -> op;
+            prog.code[j].arg = named ? 0 : instr -> arg;
+            prog.code[j].name = named ? pool + instr -> arg : NULL;
+            prog.code[j].symbol = NULL;
+        }
+        prog.length = line -> length;
+        prog.version = 0;
+
+        long long start = start_timer();
+        int value = run_program(&ctx -> vm, &prog, &ctx -> eval_error);
+        stop_timer(TIME_EVAL, start);
+
+        if (ctx -> eval_error != EVAL_NONE) {
+            report_eval_error(ctx -> eval_error);
+        }
+        else {
+            start = start_timer();
+            output_infix_result(context_out(ctx), pool + line -> infix, value);
+            stop_timer(TIME_PRINT, start);
+        }
+        ctx -> eval_error = EVAL_NONE;
+        poll_stats(stderr);
+    }
+    free_program(&prog);
+    munmap(data, info.st_size);
+}
@@ -0,0 +1,30 @@
+// Scripts of postfix lines compiled ahead of time to a binary file
+
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+/// Parses and compiles every line of a script, and writes the programs
+/// to a file that run_script maps back in.  The file holds each line's
+/// program, what the line prints, and any parse error, with the symbol
+/// names interned in one string pool.  Everything in it is an offset
+/// or an index rather than a pointer, so it loads at any address, but
+/// it is only meant for the same kind of machine.
+/// @param script The file of postfix lines, one expression a line
+/// @param filename The file to write
+/// @exception If either file can't be read or written, an error
+///     message is displayed to standard error and the program exits
+///     with EXIT_FAILURE
+void compile_script(char *script, char *filename);
+
+/// Runs a script written by compile_script, printing exactly what
+/// batch mode prints for the original lines.  The file is mapped and
+/// checked, then every line is run on the stack machine with nothing
+/// tokenized or parsed.  Standard output should already be fully
+/// buffered (see buffer_output).
+/// @param filename The compiled script
+/// @exception If the file can't be read or isn't a compiled script,
+///     an error message is displayed to standard error and the program
+///     exits with EXIT_FAILURE
+void run_script(char *filename);
+
+#endif
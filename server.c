@@ -0,0 +1,402 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "server.h"
+#include "alloc.h"
+#include "context.h"
+#include "output.h"
+#include "parser.h"
+#include "stats.h"
+
+/// A connected client
+typedef struct client_s {
+    int fd;                     ///< the client's socket
+    int index;                  ///< where it is in clients
+    char *in;                   ///< what was read and isn't evaluated yet
+    size_t in_len;              ///< the number of bytes in in
+    size_t in_size;             ///< the number of bytes allocated for in
+    output_t out;               ///< the replies, kept in memory until sent
+    size_t sent;                ///< the bytes of out already sent
+    int done;                   ///< nothing more will be read from it
+    unsigned int events;        ///< what epoll is watching it for
+} client_t;
+
+static volatile sig_atomic_t stopping;
+static int epoll_fd, listen_fd;
+static int listening;           // whether epoll is watching for new clients
+static client_t **clients;
+static int num_clients, max_clients;
+static FILE *errors;            // every client's errors go here first
+static char *error_text;        // the memory behind errors
+static size_t error_size;
+
+/// Notes that the server should stop once the current events are done
+///
+/// @param sig The signal (SIGINT or SIGTERM)
+static void request_stop(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+/// Makes a descriptor non-blocking
+///
+/// @param fd The descriptor
+/// @return Returns 0 on success, -1 if it failed
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/// Tells whether something at a path is a socket no server is using
+///
+/// @param addr The socket's address
+/// @return Returns true if it is a socket and nothing accepts on it
+static int stale_socket(struct sockaddr_un *addr) {
+    struct stat st;
+
+    if (lstat(addr -> sun_path, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+        return 0;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    int refused = connect(fd, (struct sockaddr *)addr, sizeof(*addr)) != 0 &&
+                  errno == ECONNREFUSED;
+    close(fd);
+    return refused;
+}
+
+/// Makes the listening socket
+///
+/// @param path Where to make it
+/// @return Returns the socket
+static int listen_on(char *path) {
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, path);
+    if (stale_socket(&addr)) {
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, SERVER_BACKLOG) != 0 || set_nonblocking(fd) != 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/// Starts or stops watching for new clients
+///
+/// @param on Whether to watch
+static void watch_listener(int on) {
+    struct epoll_event event;
+
+    if (on == listening) {
+        return;
+    }
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, listen_fd, &event) != 0) {
+        perror("Error watching the socket");
+        exit(EXIT_FAILURE);
+    }
+    listening = on;
+}
+
+/// Disconnects a client and frees it
+///
+/// @param client The client
+static void drop_client(client_t *client) {
+    close(client -> fd);
+    clients[client -> index] = clients[--num_clients];
+    clients[client -> index] -> index = client -> index;
+    tracked_free(client -> in);
+    tracked_free(client -> out.buf);
+    tracked_free(client);
+
+    // A descriptor is free again if accepting had run out of them
+    watch_listener(1);
+}
+
+/// Takes every connection waiting on the listening socket
+static void accept_clients(void) {
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            // Out of descriptors, stop accepting until a client leaves
+            if (errno == EMFILE || errno == ENFILE) {
+                perror("Could not accept a client");
+                watch_listener(0);
+            }
+            else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Could not accept a client");
+            }
+            return;
+        }
+
+        client_t *client = (client_t *)tracked_calloc(1, sizeof(client_t));
+        if (num_clients == max_clients) {
+            max_clients = max_clients ? max_clients * 2 : 16;
+            clients = (client_t **)tracked_realloc(clients, sizeof(client_t *) * max_clients);
+        }
+        if (client == NULL || clients == NULL) {
+            fprintf(stderr, "Could not allocate memory for a client\n");
+            exit(EXIT_FAILURE);
+        }
+        client -> fd = fd;
+        init_output(&client -> out, -1, 0);
+        client -> out.mode = standard_output() -> mode;
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = client -> events = EPOLLIN;
+        event.data.ptr = client;
+        if (set_nonblocking(fd) != 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            perror("Could not watch a client");
+            close(fd);
+            tracked_free(client);
+            continue;
+        }
+        client -> index = num_clients;
+        clients[num_clients++] = client;
+    }
+}
+
+/// Evaluates one line for a client, adding what it prints to the
+/// client's replies
+///
+/// @param client The client
+/// @param line The line
+static void evaluate(client_t *client, char *line) {
+    default_context.out = &client -> out;
+    default_context.err = errors;
+    rep(line);
+    default_context.out = NULL;
+    default_context.err = NULL;
+
+    // Errors are collected in memory and passed on after the results
+    fflush(errors);
+    long len = ftell(errors);
+    if (len > 0) {
+        output_bytes(&client -> out, error_text, len);
+        rewind(errors);
+    }
+}
+
+/// Evaluates every complete line a client has sent, and the last
+/// one once it has sent everything
+///
+/// @param client The client
+static void evaluate_lines(client_t *client) {
+    char *line = client -> in, *end = client -> in + client -> in_len, *newline;
+
+    while ((newline = memchr(line, '\n', end - line)) != NULL) {
+        *newline = '\0';
+        evaluate(client, line);
+        line = newline + 1;
+    }
+    client -> in_len = end - line;
+    memmove(client -> in, line, client -> in_len);
+
+    if (client -> in_len > SERVER_MAX_LINE) {
+        output_str(&client -> out, "Line too long to evaluate\n");
+        client -> in_len = 0;
+        client -> done = 1;
+    }
+
+    // The last line may not end with a newline
+    if (client -> done && client -> in_len) {
+        client -> in[client -> in_len] = '\0';
+        evaluate(client, client -> in);
+        client -> in_len = 0;
+    }
+}
+
+/// Reads what a client has sent
+///
+/// @param client The client
+/// @return Returns 0, or -1 if the client has gone
+static int read_client(client_t *client) {
+    // Room for a whole read and the null after the last line
+    if (client -> in_len + SERVER_READ + 1 > client -> in_size) {
+        size_t size = client -> in_size ? client -> in_size * 2 : SERVER_READ + 1;
+        char *in = (char *)tracked_realloc(client -> in, size);
+        if (in == NULL) {
+            fprintf(stderr, "Could not allocate memory for a client\n");
+            exit(EXIT_FAILURE);
+        }
+        client -> in = in;
+        client -> in_size = size;
+    }
+
+    ssize_t got = read(client -> fd, client -> in + client -> in_len, SERVER_READ);
+    if (got < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+    if (got == 0) {
+        client -> done = 1;
+    }
+    client -> in_len += got;
+    evaluate_lines(client);
+    return 0;
+}
+
+/// Sends as much of a client's replies as its socket takes
+///
+/// @param client The client
+/// @return Returns 0, or -1 if the client has gone
+static int send_replies(client_t *client) {
+    output_t *out = &client -> out;
+
+    while (client -> sent < out -> len) {
+        ssize_t wrote = send(client -> fd, out -> buf + client -> sent,
+                             out -> len - client -> sent, MSG_NOSIGNAL);
+        if (wrote < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        client -> sent += wrote;
+    }
+
+    // Keep only what is still to be sent
+    out -> len -= client -> sent;
+    memmove(out -> buf, out -> buf + client -> sent, out -> len);
+    client -> sent = 0;
+    return 0;
+}
+
+/// Reads, evaluates and replies for a client that epoll says is ready
+///
+/// @param client The client
+/// @param events What it is ready for
+static void serve_client(client_t *client, unsigned int events) {
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !client -> done &&
+        read_client(client) != 0) {
+        drop_client(client);
+        return;
+    }
+    if (send_replies(client) != 0) {
+        drop_client(client);
+        return;
+    }
+
+    // A client that sent everything leaves once it has every reply
+    size_t pending = client -> out.len;
+    if (client -> done && pending == 0) {
+        drop_client(client);
+        return;
+    }
+
+    // Stop reading from a client that isn't taking its replies
+    unsigned int want = 0;
+    if (!client -> done && pending < SERVER_MAX_PENDING) {
+        want |= EPOLLIN;
+    }
+    if (pending) {
+        want |= EPOLLOUT;
+    }
+    if (want != client -> events) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = client -> events = want;
+        event.data.ptr = client;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client -> fd, &event) != 0) {
+            perror("Could not watch a client");
+            drop_client(client);
+        }
+    }
+}
+
+void serve(char *path) {
+    struct epoll_event events[SERVER_EVENTS];
+    struct sigaction action;
+    sigset_t blocked, waiting;
+
+    // The signals are only let in while waiting, so one can't arrive
+    // between checking stopping and starting to wait
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    sigprocmask(SIG_BLOCK, &blocked, &waiting);
+    sigdelset(&waiting, SIGINT);
+    sigdelset(&waiting, SIGTERM);
+
+    errors = open_memstream(&error_text, &error_size);
+    listen_fd = listen_on(path);
+    epoll_fd = epoll_create1(0);
+    if (errors == NULL || epoll_fd < 0) {
+        perror("Could not start the server");
+        exit(EXIT_FAILURE);
+    }
+    watch_listener(1);
+
+    while (!stopping) {
+        int count = epoll_pwait(epoll_fd, events, SERVER_EVENTS, -1, &waiting);
+        if (count < 0) {
+            if (errno == EINTR) {
+                poll_stats(stderr);
+                continue;
+            }
+            perror("Error waiting for clients");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_clients();
+            }
+            else {
+                serve_client((client_t *)events[i].data.ptr, events[i].events);
+            }
+        }
+        poll_stats(stderr);
+    }
+
+    // Whatever is still being worked on is dropped
+    while (num_clients) {
+        drop_client(clients[0]);
+    }
+    tracked_free(clients);
+    clients = NULL;
+    max_clients = 0;
+    close(listen_fd);
+    close(epoll_fd);
+    listening = 0;
+    unlink(path);
+    fclose(errors);
+    free(error_text);
+    sigprocmask(SIG_UNBLOCK, &blocked, NULL);
+}
@@ -0,0 +1,30 @@
+// A long-running server evaluating the lines of many local clients
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#define SERVER_BACKLOG 128              // connections waiting to be accepted
+#define SERVER_EVENTS 64                // events handled per wait
+#define SERVER_READ (1 << 16)           // bytes read from a client at a time
+#define SERVER_MAX_LINE (1 << 20)       // longest line a client may send
+#define SERVER_MAX_PENDING (1 << 20)    // unsent reply bytes before a client's reads pause
+
+/// Listens on a Unix domain socket and evaluates the lines that clients
+/// send, until the process gets SIGINT or SIGTERM.  Every client is
+/// served from one thread by an epoll loop over non-blocking sockets,
+/// so all of them share the default context's symbol table, and the
+/// cache, the machine code and the formulas work as they do for rep.
+/// A client may send many lines at once without waiting; each line is
+/// evaluated in the order sent and gets back exactly what batch mode
+/// would print for it, results and then errors, in the output mode of
+/// standard output.  A client that sends a line longer than
+/// SERVER_MAX_LINE is told so and disconnected once its replies are
+/// sent.  The socket is removed when the server stops.
+/// @param path Where to make the socket.  A socket left there by a
+///     server that is no longer running is replaced.
+/// @exception If the socket can't be made, or one is already being
+///     served at path, an error message is displayed to standard error
+///     and the program exits with EXIT_FAILURE
+void serve(char *path);
+
+#endif
@@ -1,41 +1,75 @@
 #include "stack.h"
+#include "alloc.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 stack_t *make_stack(void) {
-    stack_t *stack = (stack_t *)malloc(sizeof(stack_t));
-    stack -> top = NULL;
+    return make_stack_owned_by(STACK_OWNS);
+}
+
+stack_t *make_stack_owned_by(stack_owner_t owner) {
+    stack_t *stack = (stack_t *)tracked_malloc(sizeof(stack_t));
+    if (stack == NULL) {
+        fprintf(stderr, "Could not allocate the stack\n");
+        exit(EXIT_FAILURE);
+    }
+    stack -> data = NULL;
+    stack -> size = 0;
+    stack -> capacity = 0;
+    stack -> owner = owner;
+    stack -> local = NULL;
     return stack;
 }
 
+void init_stack(stack_t *stack, stack_owner_t owner, void **slots, int capacity) {
+    stack -> data = slots;
+    stack -> size = 0;
+    stack -> capacity = capacity;
+    stack -> owner = owner;
+    stack -> local = slots;
+}
+
 void push(stack_t *stack, void *data) {
-    stack_node_t *new_node = (stack_node_t *) malloc(sizeof(stack_node_t));
-    
-    new_node -> data = data;      
-    
-    if (stack -> top != NULL) {
-        new_node -> next = stack -> top;
-    } else {
-        new_node -> next = NULL;
+    // Double the slots when they run out
+    if (stack -> size == stack -> capacity) {
+        int capacity = stack -> capacity ? stack -> capacity * 2 : STACK_START;
+        void **slots;
+
+        // The caller's slots are copied rather than moved
+        if (stack -> data == stack -> local) {
+            slots = (void **)tracked_malloc(capacity * sizeof(void *));
+            if (slots && stack -> size) {
+                memcpy(slots, stack -> data, stack -> size * sizeof(void *));
+            }
+        }
+        else {
+            slots = (void **)tracked_realloc(stack -> data, capacity * sizeof(void *));
+        }
+        if (slots == NULL) {
+            fprintf(stderr, "The stack could not grow\n");
+            exit(EXIT_FAILURE);
+        }
+        stack -> data = slots;
+        stack -> capacity = capacity;
     }
-    stack -> top = new_node;
+    stack -> data[stack -> size++] = data;
 }
 
 void *top(stack_t *stack) {
-    if (stack -> top)  {
-        return stack -> top -> data;
+    if (stack -> size)  {
+        return stack -> data[stack -> size - 1];
     }
-    // This error of a null stack will be handled in the parse function
+    // This error of a null stack will be handled by the caller
     return NULL;
 }
 
 void pop(stack_t *stack) {
-    if (stack -> top)  {
-        stack_node_t *top_node = stack -> top;
-        stack -> top = top_node -> next;
-
-        free(top_node -> data);
-        free(top_node);
+    if (stack -> size)  {
+        stack -> size--;
+        if (stack -> owner == STACK_OWNS) {
+            free(stack -> data[stack -> size]);
+        }
         return;
     }
     fprintf(stderr, "The stack is NULL\n");
@@ -43,20 +77,21 @@ void pop(stack_t *stack) {
 }
 
 int empty_stack(stack_t *stack) {
-    if (stack -> top) {
-        return 0;
-    } else {
-        return 1;
+    return stack -> size == 0;
+}
+
+void release_stack(stack_t *stack) {
+    if (stack -> owner == STACK_OWNS) {
+        for (int i = 0; i < stack -> size; i++) {
+            free(stack -> data[i]);
+        }
+    }
+    if (stack -> data != stack -> local) {
+        tracked_free(stack -> data);
     }
 }
 
 void free_stack(stack_t *stack) {
-    while(stack -> top) {
-        stack_node_t *top_node = stack -> top;
-        stack -> top = top_node -> next;
-        
-        free(top_node -> data);
-        free(top_node);
-    }
-    free(stack);
+    release_stack(stack);
+    tracked_free(stack);
 }
@@ -3,31 +3,58 @@
 #ifndef STACK_H
 #define STACK_H
 
-#include "stack_node.h"
+#define STACK_START 16          // slots allocated by the first push
+#define STACK_LOCAL 32          // slots a tree walk keeps on the native stack
+
+/// Who is responsible for the elements on a stack
+typedef enum stack_owner_e {
+    STACK_OWNS,                 ///< pop and free_stack free the elements (from malloc)
+    STACK_BORROWS               ///< the elements are never freed by the stack
+} stack_owner_t;
 
 typedef struct stack_s {
-    stack_node_t *top;             ///< linked list of stack_nodes
+    void **data;                ///< the elements, bottom first
+    int size;                   ///< the number of elements on the stack
+    int capacity;               ///< the number of slots allocated
+    stack_owner_t owner;        ///< whether popped elements are freed
+    void **local;               ///< the caller's slots, never freed (or NULL)
 } stack_t;
 
-/// make a new stack
-/// @return  a new stack structure with a NULL top pointer
+/// make a new stack that owns its elements
+/// @return  a new, empty stack structure
 stack_t *make_stack(void);
 
+/// make a new stack, choosing who owns the elements
+/// @param owner STACK_OWNS to free elements as they leave the stack,
+///     STACK_BORROWS to leave them to the caller
+/// @return  a new, empty stack structure
+stack_t *make_stack_owned_by(stack_owner_t owner);
+
+/// Initializes a stack kept by the caller, using the caller's slots
+/// until they run out, so a stack that stays small never allocates
+/// @param stack The stack to initialize
+/// @param owner Who owns the elements, as for make_stack_owned_by
+/// @param slots The first slots (usually an array on the native stack)
+/// @param capacity The number of slots
+void init_stack(stack_t *stack, stack_owner_t owner, void **slots, int capacity);
+
 /// Add an element to the top of the stack (stack is changed).
-/// This routine should dynamically allocate a new node.
+/// The slots double when full, so this is amortized O(1) and
+/// does not allocate per element.
 /// @param stack Points to the stack 
-/// @param data The token (C String)
+/// @param data The element (a pointer to something)
+/// @exception If the stack can't grow, the program should
+///     exit with EXIT_FAILURE
 void push(stack_t *stack, void *data);
 
 /// Return the top element from the stack (stack is unchanged)
 /// @param stack points to the stack
-/// @return the top element on the stack (a pointer to something)
-/// @exception If the stack is empty, the program should 
-///     exit with EXIT_FAILURE
+/// @return the top element on the stack (a pointer to something),
+///     or NULL if the stack is empty
 void *top(stack_t * stack);
 
 /// Removes the top element from the stack (stack is changed).
-/// This routine should free the memory associated with the top node.
+/// The element is freed if the stack owns its elements.
 /// @param stack points to the stack
 /// @exception If the stack is empty, the program should 
 ///     exit with EXIT_FAILURE
@@ -38,8 +65,14 @@ void pop(stack_t *stack);
 /// @return 0 if not empty, any other value otherwise
 int empty_stack(stack_t * stack);
 
-/// Frees all of the stack nodes, including the stack structure
+/// Frees the stack structure, and the elements still on it
+/// if the stack owns them
 /// @param stk  Points to the stack to free
 void free_stack(stack_t * stack);
 
+/// Frees the slots and elements of a stack from init_stack, but not
+/// the stack structure, which belongs to the caller
+/// @param stack Points to the stack
+void release_stack(stack_t *stack);
+
 #endif
@@ -0,0 +1,93 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+int stats_on;
+stats_t stats;
+
+static volatile sig_atomic_t stats_requested;
+
+static const char *timer_names[NUM_TIMERS] = {
+    "parse", "compile", "eval", "print", "lookup"
+};
+
+static const char *parse_error_names[NUM_PARSE_ERRORS] = {
+    "none", "too few tokens", "too many tokens", "invalid assignment",
+    "illegal token"
+};
+
+static const char *eval_error_names[NUM_EVAL_ERRORS] = {
+    "none", "division by zero", "invalid modulus", "undefined symbol",
+    "unknown operation", "unknown expression type", "missing lvalue",
+    "invalid lvalue", "symbol table full"
+};
+
+/// Notes that the stats should be printed after the current line
+///
+/// @param sig The signal (SIGUSR1)
+static void request_stats(int sig) {
+    (void)sig;
+    stats_requested = 1;
+}
+
+void start_stats(void) {
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stats;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, NULL);
+    stats_on = 1;
+}
+
+long long start_timer(void) {
+    struct timespec ts;
+
+    if (!stats_on) {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void stop_timer(stat_timer_t timer, long long start) {
+    if (stats_on) {
+        long long elapsed = start_timer() - start;
+        __atomic_fetch_add(&stats.calls[timer], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&stats.nanoseconds[timer], elapsed, __ATOMIC_RELAXED);
+    }
+}
+
+void poll_stats(FILE *fp) {
+    if (stats_requested) {
+        stats_requested = 0;
+        print_stats(fp);
+    }
+}
+
+void print_stats(FILE *fp) {
+    fprintf(fp, "STATS:\n");
+    fprintf(fp, "\texpressions: %lld\n", stats.expressions);
+    fprintf(fp, "\ttokens: %lld\n", stats.tokens);
+    fprintf(fp, "\tnodes: %lld\n", stats.nodes);
+    fprintf(fp, "\tlookups: %lld\n", stats.lookups);
+    fprintf(fp, "\tprobes: %lld\n", stats.probes);
+    fprintf(fp, "\tallocations: %lld\n", stats.allocations);
+
+    for (int i = 0; i < NUM_TIMERS; i++) {
+        long long calls = stats.calls[i], ns = stats.nanoseconds[i];
+        fprintf(fp, "\t%s: %lld calls, %.3f ms, %.1f ns/call\n", timer_names[i],
+                calls, ns / 1e6, calls ? (double)ns / calls : 0.0);
+    }
+    for (int i = 1; i < NUM_PARSE_ERRORS; i++) {
+        fprintf(fp, "\tparse error, %s: %lld\n", parse_error_names[i], stats.parse_errors[i]);
+    }
+    for (int i = 1; i < NUM_EVAL_ERRORS; i++) {
+        fprintf(fp, "\teval error, %s: %lld\n", eval_error_names[i], stats.eval_errors[i]);
+    }
+    fflush(fp);
+}
@@ -0,0 +1,64 @@
+// Counters and timers for each phase of evaluation, for --stats
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+/// The phases that are timed
+typedef enum stat_timer_e {
+    TIME_PARSE,                 ///< make_parse_tree, tokenizing and building
+    TIME_COMPILE,               ///< optimize_tree and compile_tree
+    TIME_EVAL,                  ///< run_program or eval_tree
+    TIME_PRINT,                 ///< print_infix and the value
+    TIME_LOOKUP,                ///< lookup_table
+    NUM_TIMERS
+} stat_timer_t;
+
+#define NUM_PARSE_ERRORS 5      // PARSE_NONE through ILLEGAL_TOKEN
+#define NUM_EVAL_ERRORS 9       // EVAL_NONE through SYMTAB_FULL
+
+/// Everything that is counted
+typedef struct stats_s {
+    long long expressions;      ///< lines given to rep
+    long long tokens;           ///< tokens read by make_parse_tree
+    long long nodes;            ///< tree nodes built
+    long long lookups;          ///< calls to lookup_table
+    long long probes;           ///< symbol index slots looked at
+    long long allocations;      ///< calls to malloc, calloc and realloc
+    long long parse_errors[NUM_PARSE_ERRORS];   ///< by parse_error_t
+    long long eval_errors[NUM_EVAL_ERRORS];     ///< by eval_error_t
+    long long calls[NUM_TIMERS];    ///< times each phase ran
+    long long nanoseconds[NUM_TIMERS];  ///< time spent in each phase
+} stats_t;
+
+/// Whether anything is being counted, everything is free when it isn't
+extern int stats_on;
+extern stats_t stats;
+
+/// Adds to a counter when stats are on.  Counters may be bumped
+/// from the batch worker threads, so the add is atomic.
+#define STAT_ADD(counter, n) \
+    do { if (stats_on) __atomic_fetch_add(&stats.counter, (n), __ATOMIC_RELAXED); } while (0)
+
+/// Starts counting, and prints the stats whenever the process gets SIGUSR1
+void start_stats(void);
+
+/// Reads the clock at the start of a phase
+/// @return the time in nanoseconds, or 0 when stats are off
+long long start_timer(void);
+
+/// Adds the time since start_timer to a phase
+/// @param timer The phase that ran
+/// @param start What start_timer returned
+void stop_timer(stat_timer_t timer, long long start);
+
+/// Prints the stats if SIGUSR1 arrived since the last call
+/// @param fp Where to print them
+void poll_stats(FILE *fp);
+
+/// Prints all of the counters and timers
+/// @param fp Where to print them
+void print_stats(FILE *fp);
+
+#endif
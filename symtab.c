@@ -1,170 +1,1003 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "symtab.h"
+#include "alloc.h"
+#include "arena.h"
+#include "context.h"
+#include "intern.h"
+#include "stats.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define MAX_LEN 100
+#define LOAD_CHUNK (1 << 20)    // bytes read at a time when a file can't be mapped
 
 typedef enum input_e {
     READING_NAME,
     READING_VALUE,
-    MAKE_SYMBOL,
-    COMMENT,
-    ERROR
+    COMMENT
 } input_t;
 
-static symbol_t *table;
+#define MIN_SLOTS 64
 
-void build_table(char *filename) {
-    // Read the file
-    FILE *fp = fopen(filename, "r");
-    
-    // If it is null that means we could not read it
-    if (fp == NULL) {
-        perror("Could not open the file!\n");
+#define SNAPSHOT_MAGIC "SYMTAB\n"
+#define SNAPSHOT_VERSION 1
+
+/// The start of a snapshot file.  It is followed by the symbols in
+/// dump order, then the index, then the string pool of their names.
+typedef struct snapshot_header_s {
+    char magic[8];              ///< SNAPSHOT_MAGIC
+    unsigned int version;       ///< SNAPSHOT_VERSION
+    unsigned int symbols;       ///< the number of snapshot_symbol_t
+    unsigned int slots;         ///< the number of index slots, a power of two
+    unsigned int pool_size;     ///< bytes of names
+} snapshot_header_t;
+
+/// A symbol in a snapshot
+typedef struct snapshot_symbol_s {
+    unsigned int name;          ///< the offset of the name in the pool
+    int val;
+    unsigned int hash;
+} snapshot_symbol_t;
+
+/// The index of a shared table as its readers find it, through one
+/// pointer, so they never probe the slots of one size with the mask
+/// of another
+typedef struct index_s {
+    symbol_t **slots;
+    size_t num_slots;
+} index_t;
+
+/// Memory a shared table no longer links to, waiting for its readers
+typedef struct retired_s {
+    void *memory;
+    unsigned long epoch;        ///< the epoch it was retired in
+    struct retired_s *next;     ///< retired before it
+} retired_t;
+
+/// A context's place in a shared table
+typedef struct reader_s {
+    symtab_t *symtab;           ///< the table
+    unsigned long epoch;        ///< the epoch it is reading in, 0 when it isn't
+    unsigned long pinned;       ///< the last write it sees while is_pinned
+    int is_pinned;              ///< set by ctx_pin_table
+    int in_use;                 ///< whether a context holds it
+    struct reader_s *next;      ///< the reader that joined before it
+} reader_t;
+
+/// What a table needs once it is shared
+typedef struct shared_s {
+    pthread_mutex_t lock;       ///< taken by writers, never by readers
+    index_t *index;             ///< the index readers probe
+    unsigned long epoch;        ///< the global epoch, from 1
+    unsigned long commits;      ///< the number of writes so far
+    reader_t *readers;          ///< every reader, idle ones too
+    retired_t *retired;         ///< newest first
+} shared_t;
+
+static int add_symbol(symtab_t *symtab, symbol_t *symbol);
+static int grow_slots(symtab_t *symtab, size_t count);
+static void retire(shared_t *shared, void *memory);
+static symbol_t *lookup_shared(reader_t *reader, const char *name);
+static symbol_t *create_shared(symtab_t *symtab, char *name, int val);
+static void leave_table(context_t *ctx);
+static void free_shared(symtab_t *symtab);
+
+/// Where build_table is in the file, carried from one chunk to the next
+typedef struct loader_s {
+    input_t state;
+    char *name;                 ///< the name read so far (not terminated)
+    size_t name_len;
+    size_t name_size;           ///< bytes allocated for name
+    long val;                   ///< the value read so far, as atoi would give it
+    int val_len;                ///< the number of digits read
+    int done;                   ///< set at the byte that used to read as EOF
+} loader_t;
+
+/// Makes a symbol from what the loader has read, in the pool.
+/// Symbols loaded in bulk live there instead of in their own
+/// allocations, and their names are interned.
+///
+/// @param symtab The table to add it to
+/// @param loader The loader holding the name and value
+static void make_symbol(symtab_t *symtab, loader_t *loader) {
+    symbol_t *symbol = (symbol_t *)arena_alloc(&symtab -> pool, sizeof(symbol_t));
+    char *name = intern(loader -> name, loader -> name_len);
+
+    if (symbol == NULL || name == NULL) {
+        fprintf(stderr, "Could not allocate memory for the symbol table\n");
+        exit(EXIT_FAILURE);
+    }
+    symbol -> var_name = name;
+    symbol -> val = (int)loader -> val;
+    symbol -> hash = interned_hash(name);
+    symbol -> pooled = 1;
+    symbol -> created = 0;
+    symbol -> history = NULL;
+    if (add_symbol(symtab, symbol) != 0) {
+        fprintf(stderr, "Could not allocate memory for the symbol table\n");
         exit(EXIT_FAILURE);
     }
+    loader -> name_len = 0;
+    loader -> val = 0;
+    loader -> val_len = 0;
+}
 
-    // Now to build the sym table
-    int cur_name = 0, cur_val = 0;
-    char c, *name = (char *)calloc(MAX_LEN + 1, sizeof(char)); 
-    char *val = (char *)calloc(MAX_LEN + 1, sizeof(char)); 
+/// Runs the symbol file state machine over a chunk of the file
+///
+/// @param symtab The table to add the symbols to
+/// @param loader Where the last chunk left off
+/// @param text The chunk
+/// @param len The number of bytes in the chunk
+static void scan_symbols(symtab_t *symtab, loader_t *loader, const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char c = text[i];
 
-    input_t state = READING_NAME;
+        // The file used to be read with a char compared to EOF, so
+        // this byte has always ended it
+        if (c == (char)EOF) {
+            loader -> done = 1;
+            return;
+        }
 
-    while((c = fgetc(fp)) != EOF){
-        switch(state) {
+        switch(loader -> state) {
             case READING_NAME:
-                if (name[0] != '\0' && (c == ' ' || c == '\t')) {
-                    state = READING_VALUE;
+                if (loader -> name_len && (c == ' ' || c == '\t')) {
+                    loader -> state = READING_VALUE;
                 }
                 else if (c == '#'){
-                    state = COMMENT;
-                    break;
+                    loader -> state = COMMENT;
                 }
-                else if (isalpha(c) != 0 || isdigit(c) != 0) {
-                    name[cur_name] = c;
-                    cur_name++;
-                    break;
-                } 
-                else {
-                    break;
+                else if (isalnum((unsigned char)c)) {
+                    if (loader -> name_len == loader -> name_size) {
+                        loader -> name_size *= 2;
+                        loader -> name = (char *)tracked_realloc(loader -> name, loader -> name_size);
+                        if (loader -> name == NULL) {
+                            fprintf(stderr, "Could not allocate memory for the symbol table\n");
+                            exit(EXIT_FAILURE);
+                        }
+                    }
+                    loader -> name[loader -> name_len++] = c;
                 }
+                break;
             case READING_VALUE:
-                if ((c == '\n' || c == ' ' || c == '\t') && val[0] != '\0') {
-                    state = MAKE_SYMBOL;
+                if ((c == '\n' || c == ' ' || c == '\t') && loader -> val_len) {
+                    make_symbol(symtab, loader);
+                    loader -> state = READING_NAME;
                 }
                 else if (c == '#'){
-                    state = COMMENT;
-                    break;
+                    loader -> state = COMMENT;
                 }
-                else if (isdigit(c) != 0) {
-                    val[cur_val] = c;
-                    cur_val++;
-                    break;
-                } 
-                else {
-                    break;
+                else if (isdigit((unsigned char)c)) {
+                    // Saturate the way atoi does
+                    int digit = c - '0';
+                    loader -> val = loader -> val > (LONG_MAX - digit) / 10
+                                  ? LONG_MAX : loader -> val * 10 + digit;
+                    loader -> val_len++;
                 }
-            case MAKE_SYMBOL:
-                create_symbol(name, atoi(val));
-                free(val);
-                cur_name = 0;
-                cur_val = 0;
-                name = (char *)calloc(MAX_LEN, sizeof(char) * (MAX_LEN + 1)); 
-                val = (char *)calloc(MAX_LEN, sizeof(char) * (MAX_LEN + 1));
-                state = READING_NAME; 
                 break;
             case COMMENT:
-                if (name[0] != '\0' && val[0] != '\0') {
-                    create_symbol(name, atoi(val));
-                    free(val);
-                    cur_name = 0;
-                    cur_val = 0;
-                    name = (char *)calloc(MAX_LEN, sizeof(char) * (MAX_LEN + 1)); 
-                    val = (char *)calloc(MAX_LEN, sizeof(char) * (MAX_LEN + 1)); 
+                // A symbol that has its value is kept, anything else is dropped
+                if (loader -> name_len && loader -> val_len) {
+                    make_symbol(symtab, loader);
                 }
                 if (c == '\n'){
-                    free(name);
-                    free(val);
-                    name = (char *)calloc(MAX_LEN, sizeof(char) * (MAX_LEN + 1)); 
-                    val = (char *)calloc(MAX_LEN, sizeof(char) * (MAX_LEN + 1));
-                    cur_name = 0;
-                    cur_val = 0;
-                    state = READING_NAME;
+                    loader -> name_len = 0;
+                    loader -> val = 0;
+                    loader -> val_len = 0;
+                    loader -> state = READING_NAME;
                 }
                 break;
-            case ERROR:
-                printf("We shouldn't get here!");
-                break;
-        }               
+        }
+    }
+}
+
+void ctx_build_table(context_t *ctx, char *filename) {
+    symtab_t *symtab = &ctx -> symtab;
+
+    // Read the file
+    int fd = open(filename, O_RDONLY);
+    
+    // If it is null that means we could not read it
+    if (fd < 0) {
+        perror("Could not open the file!\n");
+        exit(EXIT_FAILURE);
+    }
+
+    loader_t loader = { READING_NAME, NULL, 0, MAX_LEN, 0, 0, 0 };
+    loader.name = (char *)tracked_malloc(loader.name_size);
+    if (loader.name == NULL) {
+        fprintf(stderr, "Could not allocate memory for the symbol table\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Map the whole file and scan it in one go, or read it a chunk
+    // at a time if it can't be mapped (a pipe, say)
+    struct stat info;
+    void *text = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    if (text != MAP_FAILED) {
+        // Size the index for one symbol a line up front rather than
+        // rehashing it over and over as it fills
+        size_t lines = 0;
+        for (const char *line = (const char *)text, *end = line + info.st_size;
+             (line = memchr(line, '\n', end - line)) != NULL; line++) {
+            lines++;
+        }
+        grow_slots(symtab, symtab -> num_symbols + lines);
+        reserve_interned(lines);
+        scan_symbols(symtab, &loader, (const char *)text, info.st_size);
+        munmap(text, info.st_size);
     }
-    if (name[0]){
-        create_symbol(name, atoi(val));
-    } 
     else {
-        free(name);
+        char *chunk = (char *)tracked_malloc(LOAD_CHUNK);
+        ssize_t got;
+        if (chunk == NULL) {
+            fprintf(stderr, "Could not allocate memory for the symbol table\n");
+            exit(EXIT_FAILURE);
+        }
+        while (!loader.done && (got = read(fd, chunk, LOAD_CHUNK)) > 0) {
+            scan_symbols(symtab, &loader, chunk, got);
+        }
+        tracked_free(chunk);
     }
-    free(val);
-    fclose(fp);
+
+    // The last line may not end with a newline
+    if (loader.name_len){
+        make_symbol(symtab, &loader);
+    } 
+    tracked_free(loader.name);
+    close(fd);
 }
 
-void dump_table(void){
-    if (table){
-        symbol_t *current = table;
-        printf("SYMBOL TABLE:\n");
+void build_table(char *filename) {
+    ctx_build_table(&default_context, filename);
+}
+
+void ctx_dump_table(context_t *ctx){
+    symtab_t *symtab = ctx -> reader ? ctx -> reader -> symtab : &ctx -> symtab;
+    symbol_t *current = __atomic_load_n(&symtab -> table, __ATOMIC_ACQUIRE);
+
+    if (current){
+        output_t *out = context_out(ctx);
+        output_str(out, "SYMBOL TABLE:\n");
         while(current) {
-            printf("\tName: %s, Value: %d\n", current -> var_name, current -> val);
+            output_str(out, "\tName: ");
+            output_str(out, current -> var_name);
+            output_str(out, ", Value: ");
+            output_int(out, ctx -> reader ? ctx_shared_value(ctx, current) : current -> val);
+            output_bytes(out, "\n", 1);
             current = current -> next;
         }
     }
 }
 
-symbol_t *lookup_table(char *variable) {
-    symbol_t *current = table;
+void dump_table(void){
+    ctx_dump_table(&default_context);
+}
 
-    while(current) {
-        if (!strcmp(current -> var_name, variable)){
-            return current;
+unsigned int hash_name(const char *name) {
+    // FNV-1a, good enough spread for identifiers and cheap to compute
+    unsigned int hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/// Finds the index slot holding name, or the empty slot where it belongs
+///
+/// @param symtab The table to look in
+/// @param name The name to look for
+/// @param hash The precomputed hash of name
+/// @return Returns the slot for the name
+static symbol_t **find_slot(symtab_t *symtab, const char *name, unsigned int hash) {
+    symbol_t **slots = symtab -> slots;
+    size_t mask = symtab -> num_slots - 1;
+    size_t i = hash & mask;
+    long probes = 1;
+
+    // Linear probing, the index is never more than half full
+    while (slots[i]) {
+        if (slots[i] -> var_name == name ||
+            (slots[i] -> hash == hash && !strcmp(slots[i] -> var_name, name))) {
+            break;
         }
-        current = current -> next;
+        i = (i + 1) & mask;
+        probes++;
     }
-    return NULL;
+    STAT_ADD(probes, probes);
+    return &slots[i];
 }
 
-symbol_t *create_symbol(char *name, int val){
-    symbol_t *new_symbol = (symbol_t *)malloc(sizeof(symbol_t));
+/// Grows the index until it can hold count symbols at a load factor
+/// of one half, and rehashes every symbol into it
+///
+/// @param symtab The table to grow
+/// @param count The number of symbols to make room for
+/// @return Returns 0 on success, -1 if the memory could not be allocated
+static int grow_slots(symtab_t *symtab, size_t count) {
+    size_t old_size = symtab -> num_slots;
+    symbol_t **old_slots = symtab -> slots;
+    size_t new_size = old_size ? old_size : MIN_SLOTS;
+
+    while (count * 2 > new_size) {
+        new_size *= 2;
+    }
+    if (new_size == old_size) {
+        return 0;
+    }
+    symbol_t **new_slots = (symbol_t **)tracked_calloc(new_size, sizeof(symbol_t *));
+
+    if (new_slots == NULL) {
+        return -1;
+    }
+    index_t *index = NULL;
+    if (symtab -> shared) {
+        index = (index_t *)tracked_malloc(sizeof(index_t));
+        if (index == NULL) {
+            tracked_free(new_slots);
+            return -1;
+        }
+    }
+
+    symtab -> slots = new_slots;
+    symtab -> num_slots = new_size;
+
+    // The hashes are stored so no name needs to be rehashed
+    for (size_t i = 0; i < old_size; i++) {
+        if (old_slots[i]) {
+            *find_slot(symtab, old_slots[i] -> var_name, old_slots[i] -> hash) = old_slots[i];
+        }
+    }
+    if (index == NULL) {
+        tracked_free(old_slots);
+        return 0;
+    }
+
+    // Readers of a shared table may still be probing the old slots
+    shared_t *shared = symtab -> shared;
+    index_t *old_index = shared -> index;
+    index -> slots = new_slots;
+    index -> num_slots = new_size;
+    __atomic_store_n(&shared -> index, index, __ATOMIC_RELEASE);
+    retire(shared, old_index);
+    retire(shared, old_slots);
+    return 0;
+}
+
+unsigned long ctx_table_version(context_t *ctx) {
+    return ctx -> reader ? ctx -> reader -> symtab -> version : ctx -> symtab.version;
+}
+
+unsigned long table_version(void) {
+    return default_context.symtab.version;
+}
+
+symbol_t *ctx_lookup_table(context_t *ctx, char *variable) {
+    long long start = start_timer();
+    symbol_t *symbol = NULL;
+
+    STAT_ADD(lookups, 1);
+    if (ctx -> reader) {
+        symbol = lookup_shared(ctx -> reader, variable);
+    }
+    else if (ctx -> symtab.num_symbols != 0) {
+        symbol = *find_slot(&ctx -> symtab, variable, hash_name(variable));
+    }
+    stop_timer(TIME_LOOKUP, start);
+    return symbol;
+}
+
+symbol_t *lookup_table(char *variable) {
+    return ctx_lookup_table(&default_context, variable);
+}
+
+/// Links a symbol into the table and the index
+///
+/// @param symtab The table to add it to
+/// @param symbol The symbol, with its name, value and hash set
+/// @return Returns 0 on success, -1 if the index could not be grown
+static int add_symbol(symtab_t *symtab, symbol_t *symbol) {
+    // Keep the load factor at or below one half
+    if ((symtab -> num_symbols + 1) * 2 > symtab -> num_slots &&
+        grow_slots(symtab, symtab -> num_symbols + 1) != 0) {
+        return -1;
+    }
+
+    // The symbol is linked in with release stores, as the readers of
+    // a shared table may be walking the list or probing the index
+    symbol -> next = symtab -> table;
+    __atomic_store_n(&symtab -> table, symbol, __ATOMIC_RELEASE);
+
+    // A duplicate name replaces the old entry so the newest one wins
+    symbol_t **slot = find_slot(symtab, symbol -> var_name, symbol -> hash);
+    if (*slot == NULL) {
+        symtab -> num_symbols++;
+    }
+    else {
+        symtab -> version++;
+    }
+    __atomic_store_n(slot, symbol, __ATOMIC_RELEASE);
+    return 0;
+}
+
+symbol_t *ctx_create_symbol(context_t *ctx, char *name, int val){
+    if (ctx -> reader) {
+        return create_shared(ctx -> reader -> symtab, name, val);
+    }
+
+    symbol_t *new_symbol = (symbol_t *)tracked_malloc(sizeof(symbol_t));
 
     // This means that we could not create a new symbol
-    if (new_symbol == NULL){
+    if (new_symbol == NULL || (name = intern(name, strlen(name))) == NULL){
+        tracked_free(new_symbol);
         return NULL;
     }
 
     new_symbol -> var_name = name;
     new_symbol -> val = val;
-    new_symbol -> next = NULL;
-
-    if (table == NULL) {
-        table = new_symbol;
-    } 
-    else {
-        symbol_t *next = table;
-        table = new_symbol;
-        table -> next = next;
+    new_symbol -> hash = interned_hash(name);
+    new_symbol -> pooled = 0;
+    new_symbol -> created = 0;
+    new_symbol -> history = NULL;
+    if (add_symbol(&ctx -> symtab, new_symbol) != 0) {
+        tracked_free(new_symbol);
+        return NULL;
     }
     return new_symbol;
 }
 
-void free_table(void){
-    symbol_t *current = table;
+symbol_t *create_symbol(char *name, int val){
+    return ctx_create_symbol(&default_context, name, val);
+}
+
+void ctx_save_table(context_t *ctx, char *filename) {
+    symtab_t *symtab = &ctx -> symtab;
+    size_t num_slots = symtab -> num_slots;
+    snapshot_header_t header;
+    size_t count = 0, pool_size = 0;
+
+    for (symbol_t *cur = symtab -> table; cur; cur = cur -> next) {
+        count++;
+        pool_size += strlen(cur -> var_name) + 1;
+    }
+    if (count > UINT_MAX || pool_size > UINT_MAX || num_slots > UINT_MAX) {
+        fprintf(stderr, "The symbol table is too big to save\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.symbols = count;
+    header.slots = num_slots;
+    header.pool_size = pool_size;
+
+    // The index refers to symbols by their position in dump order
+    snapshot_symbol_t *symbols = (snapshot_symbol_t *)tracked_malloc(count * sizeof(snapshot_symbol_t) + 1);
+    unsigned int *index = (unsigned int *)tracked_calloc(num_slots + 1, sizeof(unsigned int));
+    char *names = (char *)tracked_malloc(pool_size + 1);
+    if (symbols == NULL || index == NULL || names == NULL) {
+        fprintf(stderr, "Could not allocate memory to save the symbol table\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t i = 0, offset = 0;
+    for (symbol_t *cur = symtab -> table; cur; cur = cur -> next, i++) {
+        size_t len = strlen(cur -> var_name) + 1;
+        symbols[i].name = offset;
+        symbols[i].val = cur -> val;
+        symbols[i].hash = cur -> hash;
+        memcpy(names + offset, cur -> var_name, len);
+        offset += len;
+
+        // Only the newest symbol of a name is in the index
+        symbol_t **slot = find_slot(symtab, cur -> var_name, cur -> hash);
+        if (*slot == cur) {
+            index[slot - symtab -> slots] = i + 1;
+        }
+    }
+
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(symbols, sizeof(snapshot_symbol_t), count, fp);
+    fwrite(index, sizeof(unsigned int), num_slots, fp);
+    fwrite(names, 1, pool_size, fp);
+    int failed = ferror(fp);
+    if (fclose(fp) != 0 || failed) {
+        fprintf(stderr, "Error writing %s\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    tracked_free(names);
+    tracked_free(index);
+    tracked_free(symbols);
+}
+
+void save_table(char *filename) {
+    ctx_save_table(&default_context, filename);
+}
+
+/// Reports a snapshot that can't be loaded and exits
+///
+/// @param filename The snapshot
+static void bad_snapshot(char *filename) {
+    fprintf(stderr, "%s is not a symbol table snapshot\n", filename);
+    exit(EXIT_FAILURE);
+}
+
+void ctx_load_table(context_t *ctx, char *filename) {
+    symtab_t *symtab = &ctx -> symtab;
+    int fd = open(filename, O_RDONLY);
+    struct stat info;
+
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)info.st_size < sizeof(snapshot_header_t)) {
+        bad_snapshot(filename);
+    }
+    char *data = (char *)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+
+    // Check everything fits before trusting any of it
+    snapshot_header_t *header = (snapshot_header_t *)data;
+    size_t count = header -> symbols, size = header -> slots;
+    size_t expected = sizeof(snapshot_header_t) + count * sizeof(snapshot_symbol_t)
+                    + size * sizeof(unsigned int) + header -> pool_size;
+    if (memcmp(header -> magic, SNAPSHOT_MAGIC, sizeof(header -> magic)) ||
+        header -> version != SNAPSHOT_VERSION || expected != (size_t)info.st_size ||
+        (size & (size - 1)) || (count && size == 0) ||
+        (header -> pool_size && data[info.st_size - 1] != '\0')) {
+        bad_snapshot(filename);
+    }
+    snapshot_symbol_t *symbols = (snapshot_symbol_t *)(header + 1);
+    unsigned int *index = (unsigned int *)(symbols + count);
+    char *names = (char *)(index + size);
+
+    ctx_free_table(ctx);
+    symtab -> snapshot = data;
+    symtab -> snapshot_size = info.st_size;
+    if (count == 0) {
+        return;
+    }
+
+    // The names are used where they are mapped, only the symbols and
+    // the index are built, and nothing needs hashing
+    symbol_t *loaded = (symbol_t *)arena_alloc(&symtab -> pool, count * sizeof(symbol_t));
+    symbol_t **slots = (symbol_t **)tracked_malloc(size * sizeof(symbol_t *));
+    if (loaded == NULL || slots == NULL) {
+        fprintf(stderr, "Could not allocate memory for the symbol table\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (symbols[i].name >= header -> pool_size) {
+            bad_snapshot(filename);
+        }
+        loaded[i].var_name = names + symbols[i].name;
+        loaded[i].val = symbols[i].val;
+        loaded[i].hash = symbols[i].hash;
+        loaded[i].pooled = 1;
+        loaded[i].created = 0;
+        loaded[i].history = NULL;
+        loaded[i].next = i + 1 < count ? &loaded[i + 1] : NULL;
+    }
+    for (size_t i = 0; i < size; i++) {
+        if (index[i] > count) {
+            bad_snapshot(filename);
+        }
+        slots[i] = index[i] ? &loaded[index[i] - 1] : NULL;
+        symtab -> num_symbols += index[i] != 0;
+    }
+    // Lookups need the index to have empty slots
+    if (symtab -> num_symbols * 2 > size) {
+        bad_snapshot(filename);
+    }
+    symtab -> table = loaded;
+    symtab -> slots = slots;
+    symtab -> num_slots = size;
+}
+
+void load_table(char *filename) {
+    ctx_load_table(&default_context, filename);
+}
+
+void ctx_free_table(context_t *ctx){
+    symtab_t *symtab = &ctx -> symtab;
+
+    if (ctx -> reader) {
+        leave_table(ctx);
+    }
+    if (symtab -> shared) {
+        free_shared(symtab);
+    }
+
+    symbol_t *current = symtab -> table;
 
     while(current) {
         symbol_t *to_remove = current;
 
         current = current -> next;
 
-        free(to_remove -> var_name);
-        free(to_remove);
+        if (!to_remove -> pooled) {
+            tracked_free(to_remove);
+        }
+    }
+    tracked_free(symtab -> slots);
+    arena_free(&symtab -> pool);
+    if (symtab -> snapshot) {
+        munmap(symtab -> snapshot, symtab -> snapshot_size);
+    }
+    symtab -> version++;
+    symtab -> table = NULL;
+    symtab -> slots = NULL;
+    symtab -> snapshot = NULL;
+    symtab -> num_slots = 0;
+    symtab -> num_symbols = 0;
+}
+
+void free_table(void){
+    ctx_free_table(&default_context);
+}
+
+/// Reports running out of memory for a shared table and exits
+static void shared_out_of_memory(void) {
+    fprintf(stderr, "Could not allocate memory for the shared symbol table\n");
+    exit(EXIT_FAILURE);
+}
+
+/// Hands memory a shared table no longer links to over to be freed
+/// once no reader can still be looking at it.  Called with the lock held.
+///
+/// @param shared The table
+/// @param memory What to free
+static void retire(shared_t *shared, void *memory) {
+    retired_t *retired = (retired_t *)tracked_malloc(sizeof(retired_t));
+
+    if (retired == NULL) {
+        shared_out_of_memory();
+    }
+    retired -> memory = memory;
+    retired -> epoch = shared -> epoch;
+    retired -> next = shared -> retired;
+    shared -> retired = retired;
+}
+
+/// Moves the epoch on if every reader that is reading is in it, then
+/// frees what was retired two epochs ago.  A reader entering an epoch
+/// only finds what was still linked in when it read the epoch, so
+/// nothing retired before the one it is in can be reached by it.
+/// Called with the lock held.
+///
+/// @param shared The table
+static void collect(shared_t *shared) {
+    unsigned long epoch = shared -> epoch;
+    reader_t *reader;
+
+    for (reader = shared -> readers; reader; reader = reader -> next) {
+        unsigned long seen = __atomic_load_n(&reader -> epoch, __ATOMIC_SEQ_CST);
+        if (seen != 0 && seen != epoch) {
+            break;
+        }
+    }
+    if (reader == NULL) {
+        __atomic_store_n(&shared -> epoch, ++epoch, __ATOMIC_SEQ_CST);
+    }
+
+    // The list is newest first, so what can be freed is at its end
+    retired_t **link = &shared -> retired;
+    while (*link && (*link) -> epoch + 2 > epoch) {
+        link = &(*link) -> next;
+    }
+    retired_t *old = *link;
+    *link = NULL;
+    while (old) {
+        retired_t *next = old -> next;
+        tracked_free(old -> memory);
+        tracked_free(old);
+        old = next;
+    }
+}
+
+/// Announces that a reader is about to look at the table
+///
+/// @param reader The reader
+static void enter_epoch(reader_t *reader) {
+    shared_t *shared = reader -> symtab -> shared;
+
+    __atomic_store_n(&reader -> epoch, __atomic_load_n(&shared -> epoch, __ATOMIC_SEQ_CST),
+                     __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/// Announces that a reader has stopped looking at the table
+///
+/// @param reader The reader
+static void leave_epoch(reader_t *reader) {
+    __atomic_store_n(&reader -> epoch, 0, __ATOMIC_RELEASE);
+}
+
+/// Looks a name up in a shared table, without taking the lock
+///
+/// @param reader The reader looking
+/// @param name The name to look for
+/// @return Returns the symbol, or NULL if there isn't one (or wasn't
+///     one when the reader pinned the table)
+static symbol_t *lookup_shared(reader_t *reader, const char *name) {
+    shared_t *shared = reader -> symtab -> shared;
+    unsigned int hash = hash_name(name);
+    symbol_t *symbol;
+    long probes = 1;
+
+    if (!reader -> is_pinned) {
+        enter_epoch(reader);
+    }
+    index_t *index = __atomic_load_n(&shared -> index, __ATOMIC_ACQUIRE);
+    size_t mask = index -> num_slots - 1;
+    size_t i = hash & mask;
+    while ((symbol = __atomic_load_n(&index -> slots[i], __ATOMIC_ACQUIRE)) != NULL) {
+        if (symbol -> hash == hash && !strcmp(symbol -> var_name, name)) {
+            break;
+        }
+        i = (i + 1) & mask;
+        probes++;
+    }
+    STAT_ADD(probes, probes);
+
+    // Symbols are only freed with the table, so they outlive the epoch
+    if (!reader -> is_pinned) {
+        leave_epoch(reader);
     }
-}
\ No newline at end of file
+    else if (symbol && symbol -> created > reader -> pinned) {
+        symbol = NULL;
+    }
+    return symbol;
+}
+
+/// Binds a value to a symbol of a shared table, keeping the value it
+/// replaces for readers pinned before.  Called with the lock held.
+///
+/// @param shared The table
+/// @param symbol The symbol
+/// @param val The value
+static void publish_value(shared_t *shared, symbol_t *symbol, int val) {
+    value_t *value = (value_t *)tracked_malloc(sizeof(value_t));
+    value_t *older = symbol -> history;
+
+    // The value it had when the table was shared, or it was added
+    if (older == NULL && value) {
+        older = (value_t *)tracked_malloc(sizeof(value_t));
+        if (older) {
+            older -> val = symbol -> val;
+            older -> commit = symbol -> created;
+            older -> older = NULL;
+        }
+    }
+    if (value == NULL || older == NULL) {
+        shared_out_of_memory();
+    }
+    value -> val = val;
+    value -> commit = shared -> commits + 1;
+    value -> older = older;
+
+    // The history goes first, see ctx_shared_value
+    __atomic_store_n(&symbol -> history, value, __ATOMIC_RELEASE);
+    __atomic_store_n(&symbol -> val, val, __ATOMIC_RELEASE);
+    __atomic_store_n(&shared -> commits, value -> commit, __ATOMIC_SEQ_CST);
+
+    // Only readers pinned before this write walk past it to older, and
+    // they are all in this epoch or an earlier one
+    retire(shared, older);
+    collect(shared);
+}
+
+/// Adds a symbol to a shared table, or if another thread added the
+/// name first, assigns that symbol
+///
+/// @param symtab The table
+/// @param name The name of the symbol
+/// @param val The value
+/// @return Returns the symbol, or NULL if it could not be allocated
+static symbol_t *create_shared(symtab_t *symtab, char *name, int val) {
+    shared_t *shared = symtab -> shared;
+    unsigned int hash = hash_name(name);
+
+    pthread_mutex_lock(&shared -> lock);
+    symbol_t *symbol = *find_slot(symtab, name, hash);
+    if (symbol) {
+        publish_value(shared, symbol, val);
+    }
+    else if ((name = intern(name, strlen(name))) != NULL &&
+             (symbol = (symbol_t *)tracked_malloc(sizeof(symbol_t))) != NULL) {
+        symbol -> var_name = name;
+        symbol -> val = val;
+        symbol -> hash = hash;
+        symbol -> pooled = 0;
+        symbol -> created = shared -> commits + 1;
+        symbol -> history = NULL;
+        if (add_symbol(symtab, symbol) != 0) {
+            tracked_free(symbol);
+            symbol = NULL;
+        }
+        else {
+            __atomic_store_n(&shared -> commits, symbol -> created, __ATOMIC_SEQ_CST);
+            collect(shared);
+        }
+    }
+    pthread_mutex_unlock(&shared -> lock);
+    return symbol;
+}
+
+int ctx_shared_value(context_t *ctx, symbol_t *symbol) {
+    reader_t *reader = ctx -> reader;
+
+    // A new value is stored after its history, so if there is no
+    // history yet the value read first is the one it was shared with
+    int val = __atomic_load_n(&symbol -> val, __ATOMIC_ACQUIRE);
+    if (!reader -> is_pinned) {
+        return val;
+    }
+    value_t *value = __atomic_load_n(&symbol -> history, __ATOMIC_ACQUIRE);
+    if (value == NULL) {
+        return val;
+    }
+
+    // The values walked past were written after the pin, so the ones
+    // they replaced were retired no earlier than the reader's epoch
+    while (value -> commit > reader -> pinned && value -> older) {
+        value = value -> older;
+    }
+    return value -> val;
+}
+
+void ctx_shared_assign(context_t *ctx, symbol_t *symbol, int val) {
+    shared_t *shared = ctx -> reader -> symtab -> shared;
+
+    pthread_mutex_lock(&shared -> lock);
+    publish_value(shared, symbol, val);
+    pthread_mutex_unlock(&shared -> lock);
+}
+
+void ctx_share_table(context_t *ctx) {
+    symtab_t *symtab = &ctx -> symtab;
+
+    if (ctx == &default_context) {
+        fprintf(stderr, "The default symbol table can't be shared\n");
+        exit(EXIT_FAILURE);
+    }
+    if (symtab -> shared) {
+        return;
+    }
+
+    // Readers always have slots to probe
+    shared_t *shared = (shared_t *)tracked_calloc(1, sizeof(shared_t));
+    index_t *index = (index_t *)tracked_malloc(sizeof(index_t));
+    if (shared == NULL || index == NULL || grow_slots(symtab, MIN_SLOTS / 2) != 0) {
+        shared_out_of_memory();
+    }
+    index -> slots = symtab -> slots;
+    index -> num_slots = symtab -> num_slots;
+    pthread_mutex_init(&shared -> lock, NULL);
+    shared -> index = index;
+    shared -> epoch = 1;
+    symtab -> shared = shared;
+    ctx_join_table(ctx, ctx);
+}
+
+void ctx_join_table(context_t *ctx, context_t *owner) {
+    shared_t *shared = owner -> symtab.shared;
+
+    if (shared == NULL) {
+        fprintf(stderr, "The symbol table to join isn't shared\n");
+        exit(EXIT_FAILURE);
+    }
+    if (ctx -> reader) {
+        leave_table(ctx);
+    }
+
+    // Readers are never unlinked while the table is shared, so collect
+    // can walk them, but the places of ones that left are reused
+    pthread_mutex_lock(&shared -> lock);
+    reader_t *reader = shared -> readers;
+    while (reader && reader -> in_use) {
+        reader = reader -> next;
+    }
+    if (reader == NULL) {
+        reader = (reader_t *)tracked_calloc(1, sizeof(reader_t));
+        if (reader == NULL) {
+            shared_out_of_memory();
+        }
+        reader -> next = shared -> readers;
+        shared -> readers = reader;
+    }
+    reader -> symtab = &owner -> symtab;
+    reader -> epoch = 0;
+    reader -> is_pinned = 0;
+    reader -> in_use = 1;
+    pthread_mutex_unlock(&shared -> lock);
+    ctx -> reader = reader;
+}
+
+/// Stops a context using a shared table
+///
+/// @param ctx The context
+static void leave_table(context_t *ctx) {
+    reader_t *reader = ctx -> reader;
+    shared_t *shared = reader -> symtab -> shared;
+
+    ctx_unpin_table(ctx);
+    pthread_mutex_lock(&shared -> lock);
+    reader -> in_use = 0;
+    pthread_mutex_unlock(&shared -> lock);
+    ctx -> reader = NULL;
+}
+
+void ctx_pin_table(context_t *ctx) {
+    reader_t *reader = ctx -> reader;
+
+    if (reader == NULL || reader -> is_pinned) {
+        return;
+    }
+    enter_epoch(reader);
+    reader -> pinned = __atomic_load_n(&reader -> symtab -> shared -> commits, __ATOMIC_SEQ_CST);
+    reader -> is_pinned = 1;
+}
+
+void ctx_unpin_table(context_t *ctx) {
+    reader_t *reader = ctx -> reader;
+
+    if (reader == NULL || !reader -> is_pinned) {
+        return;
+    }
+    reader -> is_pinned = 0;
+    leave_epoch(reader);
+}
+
+/// Frees what a table needed to be shared, once every other context
+/// has left it
+///
+/// @param symtab The table
+static void free_shared(symtab_t *symtab) {
+    shared_t *shared = symtab -> shared;
+
+    // Only the newest value of each symbol hasn't been retired
+    for (symbol_t *cur = symtab -> table; cur; cur = cur -> next) {
+        tracked_free(cur -> history);
+        cur -> history = NULL;
+    }
+    while (shared -> retired) {
+        retired_t *next = shared -> retired -> next;
+        tracked_free(shared -> retired -> memory);
+        tracked_free(shared -> retired);
+        shared -> retired = next;
+    }
+    while (shared -> readers) {
+        reader_t *next = shared -> readers -> next;
+        tracked_free(shared -> readers);
+        shared -> readers = next;
+    }
+    tracked_free(shared -> index);
+    pthread_mutex_destroy(&shared -> lock);
+    tracked_free(shared);
+    symtab -> shared = NULL;
+}
@@ -3,16 +3,47 @@
 #ifndef SYMTAB_H
 #define SYMTAB_H
 
+#include <stddef.h>
+#include "arena.h"
+
 #define BUFLEN 1024             // input buffer length for initial symbols
 
+/// A value a symbol of a shared table had, kept for pinned readers
+typedef struct value_s {
+    int val;                    ///< the value
+    unsigned long commit;       ///< the write that bound it
+    struct value_s *older;      ///< the value it replaced
+} value_t;
+
 /// A single symbol definition
 typedef struct symbol_s {
     char *var_name;             ///< the name of the symbol
     int val;                    ///< the value currently bound to this symbol
-    struct symbol_s *next;      ///< the next item in the list
+    unsigned int hash;          ///< precomputed hash of var_name
+    int pooled;                 ///< set if the symbol is in the table's pool
+    unsigned long created;      ///< the write that added it to a shared table (0 before)
+    value_t *history;           ///< the values since it was shared, newest first
+    struct symbol_s *next;      ///< the next item in the list (newest first)
 } symbol_t;
 
-/// Constructs the table by reading the file.  The format is
+/// A symbol table.  Every interpreter context has its own (see
+/// context.h), the functions below work on the default context's.
+/// All zeros is an empty table.
+typedef struct symtab_s {
+    symbol_t *table;            ///< every symbol, newest first (dump order)
+    symbol_t **slots;           ///< open-addressing index into the table
+    size_t num_slots;           ///< always a power of two
+    size_t num_symbols;         ///< the number of distinct names
+    unsigned long version;      ///< see table_version
+    arena_t pool;               ///< symbols loaded in bulk
+    void *snapshot;             ///< a mapped snapshot the names point into
+    size_t snapshot_size;       ///< the bytes mapped
+    struct shared_s *shared;    ///< set once the table is shared (see ctx_share_table)
+} symtab_t;
+
+/// Constructs the table by reading the file.  The file is mapped
+/// into memory and scanned in one pass, the symbols are allocated
+/// together in large blocks and their names are interned.  The format is
 /// one symbol per line in the format:
 ///
 ///     variable-type variable-name     variable-value
@@ -41,13 +72,50 @@ void build_table(char *filename);
 /// Each symbol should be printed one per line, tab-indented.
 void dump_table(void);
 
-/// Returns the symbol associated with variable name
+/// Returns the symbol associated with variable name.  Symbols are
+/// kept in an open-addressing hash index, so this is O(1) on average.
 /// @param variable The name of the variable
 /// @return The symbol_t object containing the binding, or NULL if not found
 symbol_t *lookup_table(char *variable);
 
+/// Adds a new symbol to the table.  The name is interned (see intern.h),
+/// so the caller keeps whatever it passed.  If a symbol with the same
+/// name already exists the new one shadows it in lookups.
+/// @param name The name of the symbol
+/// @param val The initial value bound to the symbol
+/// @return The new symbol, or NULL if it could not be allocated
 symbol_t *create_symbol(char *name, int val);
 
+/// Tells whether symbols found earlier are still the ones lookups
+/// would find.  The version changes whenever a symbol is freed or
+/// shadowed by a newer one of the same name, but not when a new
+/// name is added.
+/// @return the version of the table
+unsigned long table_version(void);
+
+/// Computes the hash used to index symbol names
+/// @param name The name to hash
+/// @return the hash of the name
+unsigned int hash_name(const char *name);
+
+/// Writes the symbol table to a snapshot that load_table can map back
+/// in.  The snapshot holds the symbols in dump order, the names in one
+/// string pool and the hash index as it is, so it is only meant to be
+/// loaded on the same kind of machine.
+/// @param filename The file to write
+/// @exception If the file can't be written, an error message is
+///     displayed to standard error and the program exits with EXIT_FAILURE
+void save_table(char *filename);
+
+/// Replaces the symbol table with a snapshot written by save_table.
+/// The file is mapped and the names are used in place, so nothing is
+/// parsed or hashed and loading takes one pass over the symbols.
+/// @param filename The snapshot to load
+/// @exception If the file can't be read or isn't a snapshot, an error
+///     message is displayed to standard error and the program exits
+///     with EXIT_FAILURE
+void load_table(char *filename);
+
 /// Destroys the symbol table
 void free_table(void);
 
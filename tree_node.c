@@ -1,32 +1,40 @@
 #include "tree_node.h"
-#include <stdlib.h>
+#include "stats.h"
 
-tree_node_t *make_interior(op_type_t op, char *token, tree_node_t *left, tree_node_t *right) {
-    interior_node_t *new_interior = (interior_node_t *)malloc(sizeof(interior_node_t));
-    tree_node_t *new_tree_node = (tree_node_t *)malloc(sizeof(tree_node_t));
+const char *const op_spelling[NO_OP] = {
+    ADD_OP_STR, SUB_OP_STR, MUL_OP_STR, DIV_OP_STR, MOD_OP_STR,
+    ASSIGN_OP_STR, Q_OP_STR, ALT_OP_STR
+};
+
+tree_node_t *make_interior(arena_t *arena, op_type_t op, tree_node_t *left, tree_node_t *right) {
+    interior_node_t *new_interior = (interior_node_t *)arena_alloc(arena, sizeof(interior_node_t));
+    tree_node_t *new_tree_node = (tree_node_t *)arena_alloc(arena, sizeof(tree_node_t));
 
     if (new_interior == NULL || new_tree_node == NULL)
         return NULL;
 
+    STAT_ADD(nodes, 1);
     new_interior -> op = op;
     new_interior -> left = left;
     new_interior -> right = right;
 
     new_tree_node -> type = INTERIOR;
-    new_tree_node -> token = token;
+    new_tree_node -> token = (char *)op_spelling[op];
     new_tree_node -> node = new_interior;
 
     return new_tree_node;
 }
 
-tree_node_t *make_leaf(exp_type_t exp_type, char *token) {
-    leaf_node_t *new_leaf = (leaf_node_t *)malloc(sizeof(leaf_node_t));
-    tree_node_t *new_tree_node = (tree_node_t *)malloc(sizeof(tree_node_t));
+tree_node_t *make_leaf(arena_t *arena, exp_type_t exp_type, char *token, int value) {
+    leaf_node_t *new_leaf = (leaf_node_t *)arena_alloc(arena, sizeof(leaf_node_t));
+    tree_node_t *new_tree_node = (tree_node_t *)arena_alloc(arena, sizeof(tree_node_t));
 
     if (new_leaf == NULL || new_tree_node == NULL)
         return NULL;
 
+    STAT_ADD(nodes, 1);
     new_leaf -> exp_type = exp_type;
+    new_leaf -> value = value;
 
     new_tree_node -> type = LEAF;
     new_tree_node -> token = token;
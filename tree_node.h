@@ -4,6 +4,7 @@
 #define TREE_NODE_H
 
 #include "symtab.h"
+#include "arena.h"
 
 // Operation tokens
 #define ADD_OP_STR	"+"
@@ -13,6 +14,7 @@
 #define MOD_OP_STR	"%"
 #define Q_OP_STR        "?"
 #define ASSIGN_OP_STR	"="
+#define ALT_OP_STR	":"
 
 // valid operations types for interior nodes
 typedef enum op_type_e {
@@ -27,6 +29,9 @@ typedef enum op_type_e {
     NO_OP                       ///< not an op
 } op_type_t;
 
+/// How each operation is written, indexed by op_type_t
+extern const char *const op_spelling[NO_OP];
+
 // Valid types of leaf nodes (tells how to interpret the token)
 typedef enum exp_type_e {
     INTEGER,                    ///< constant integer literal
@@ -42,7 +47,7 @@ typedef enum node_type_e {
 // Represents a node in the parse tree
 typedef struct tree_node_s {
     node_type_t type;           ///< the type of the node
-    char *token;                ///< the token that derived this node
+    char *token;                ///< the token that derived this node (see make_interior)
     void *node;                 ///< either an interiorNode or leafNode
 } tree_node_t;
 
@@ -54,21 +59,25 @@ typedef struct interior_node_s {
 
 typedef struct leaf_node_s {
     exp_type_t exp_type;        ///< INTEGER, DOUBLE, or SYMBOL
+    int value;                  ///< the value of an INTEGER literal
 } leaf_node_t;
 
-/// Construct an interior node dynamically on the heap.
+/// Construct an interior node in an arena.  Its token is the
+/// op's entry in op_spelling, nothing is copied.
+/// @param arena  the arena the node is allocated from
 /// @param op  the operation (add, subtract, etc.)
-/// @param token  the token that derives this node
 /// @param left  pointer to the left child of this node
 /// @param right pointer to the right child of this node
 /// @return the new TreeNode, or NULL if error
-tree_node_t *make_interior(op_type_t op, char *token,
+tree_node_t *make_interior(arena_t *arena, op_type_t op,
                        tree_node_t *left, tree_node_t *right);
 
-/// Construct a leaf node dynamically on the heap.
+/// Construct a leaf node in an arena.
+/// @param arena  the arena the node is allocated from
 /// @param expType  the operation token type (INTEGER or SYMBOL)
-/// @param token  the token that derives this node
+/// @param token  the token that derives this node (not copied)
+/// @param value  the value of an INTEGER literal (ignored otherwise)
 /// @return the new TreeNode, or NULL if error
-tree_node_t *make_leaf(exp_type_t exp_type, char *token);
+tree_node_t *make_leaf(arena_t *arena, exp_type_t exp_type, char *token, int value);
 
 #endif